@@ -0,0 +1,365 @@
+/*
+   This file is part of DirectFB.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include <core/layers.h>
+#include <core/surface_allocation.h>
+#include <core/surface_buffer.h>
+#include <core/surface_pool.h>
+#include <sys/mman.h>
+
+#include "egl_system.h"
+
+D_DEBUG_DOMAIN( EGL_Dumb, "EGL/Dumb", "EGL Dumb Buffer Pool" );
+
+/**********************************************************************************************************************/
+
+typedef struct {
+     EGLData  *egl;
+} EGLDumbPoolLocalData;
+
+typedef struct {
+     int       magic;
+
+     int       pitch;
+     int       size;
+
+     uint32_t  handle;      /* dumb buffer handle */
+     uint32_t  fb_id;       /* framebuffer for scanout */
+     void     *addr;        /* mapping of the dumb buffer */
+} EGLDumbAllocationData;
+
+/**********************************************************************************************************************/
+
+static uint32_t
+dumb_format( DFBSurfacePixelFormat format )
+{
+     switch (format) {
+          case DSPF_ARGB:
+          case DSPF_RGB32:
+               /* The alpha channel is ignored by the primary plane. */
+               return DRM_FORMAT_XRGB8888;
+
+          case DSPF_RGB16:
+               return DRM_FORMAT_RGB565;
+
+          default:
+               return 0;
+     }
+}
+
+/**********************************************************************************************************************/
+
+static int
+eglDumbPoolLocalDataSize()
+{
+     return sizeof(EGLDumbPoolLocalData);
+}
+
+static int
+eglDumbAllocationDataSize()
+{
+     return sizeof(EGLDumbAllocationData);
+}
+
+static DFBResult
+eglDumbInitPool( CoreDFB                    *core,
+                 CoreSurfacePool            *pool,
+                 void                       *pool_data,
+                 void                       *pool_local,
+                 void                       *system_data,
+                 CoreSurfacePoolDescription *ret_desc )
+{
+     EGLDumbPoolLocalData *local = pool_local;
+
+     D_DEBUG_AT( EGL_Dumb, "%s()\n", __FUNCTION__ );
+
+     D_ASSERT( core != NULL );
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+     D_ASSERT( system_data != NULL );
+     D_ASSERT( ret_desc != NULL );
+
+     local->egl = system_data;
+
+     /* The software renderer draws directly into the scanout buffers. */
+     ret_desc->caps                 = CSPCAPS_VIRTUAL;
+     ret_desc->access[CSAID_CPU]    = CSAF_READ | CSAF_WRITE | CSAF_SHARED;
+     ret_desc->access[CSAID_LAYER0] = CSAF_READ | CSAF_SHARED;
+     ret_desc->types                = CSTF_LAYER | CSTF_SHARED;
+     ret_desc->priority             = CSPP_PREFERED;
+
+     snprintf( ret_desc->name, DFB_SURFACE_POOL_DESC_NAME_LENGTH, "EGL Dumb Buffer Pool" );
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbJoinPool( CoreDFB         *core,
+                 CoreSurfacePool *pool,
+                 void            *pool_data,
+                 void            *pool_local,
+                 void            *system_data )
+{
+     EGLDumbPoolLocalData *local = pool_local;
+
+     D_DEBUG_AT( EGL_Dumb, "%s()\n", __FUNCTION__ );
+
+     D_ASSERT( core != NULL );
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+     D_ASSERT( system_data != NULL );
+
+     local->egl = system_data;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbDestroyPool( CoreSurfacePool *pool,
+                    void            *pool_data,
+                    void            *pool_local )
+{
+     D_DEBUG_AT( EGL_Dumb, "%s()\n", __FUNCTION__ );
+
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbLeavePool( CoreSurfacePool *pool,
+                  void            *pool_data,
+                  void            *pool_local )
+{
+     D_DEBUG_AT( EGL_Dumb, "%s()\n", __FUNCTION__ );
+
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbTestConfig( CoreSurfacePool         *pool,
+                   void                    *pool_data,
+                   void                    *pool_local,
+                   CoreSurfaceBuffer       *buffer,
+                   const CoreSurfaceConfig *config )
+{
+     CoreSurface *surface;
+
+     D_DEBUG_AT( EGL_Dumb, "%s( %p )\n", __FUNCTION__, buffer );
+
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_MAGIC_ASSERT( buffer, CoreSurfaceBuffer );
+     D_MAGIC_ASSERT( buffer->surface, CoreSurface );
+
+     surface = buffer->surface;
+
+     /* Only the primary layer is scanned out, other surfaces stay in system memory. */
+     if (!(surface->type & CSTF_LAYER) || surface->resource_id != DLID_PRIMARY)
+          return DFB_UNSUPPORTED;
+
+     if (!dumb_format( config->format ))
+          return DFB_UNSUPPORTED;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbAllocateBuffer( CoreSurfacePool       *pool,
+                       void                  *pool_data,
+                       void                  *pool_local,
+                       CoreSurfaceBuffer     *buffer,
+                       CoreSurfaceAllocation *allocation,
+                       void                  *alloc_data )
+{
+     EGLDumbPoolLocalData         *local = pool_local;
+     EGLDumbAllocationData        *alloc = alloc_data;
+     EGLData                      *egl;
+     CoreSurface                  *surface;
+     struct drm_mode_create_dumb   creq;
+     struct drm_mode_map_dumb      mreq;
+     struct drm_mode_destroy_dumb  dreq;
+     uint32_t                      handles[4] = { 0 };
+     uint32_t                      strides[4] = { 0 };
+     uint32_t                      offsets[4] = { 0 };
+
+     D_DEBUG_AT( EGL_Dumb, "%s( %p )\n", __FUNCTION__, buffer );
+
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_MAGIC_ASSERT( buffer, CoreSurfaceBuffer );
+     D_MAGIC_ASSERT( buffer->surface, CoreSurface );
+     D_ASSERT( local != NULL );
+
+     egl     = local->egl;
+     surface = buffer->surface;
+
+     memset( &creq, 0, sizeof(creq) );
+     creq.width  = surface->config.size.w;
+     creq.height = surface->config.size.h;
+     creq.bpp    = DFB_BITS_PER_PIXEL( buffer->format );
+
+     if (drmIoctl( egl->fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq )) {
+          D_PERROR( "EGL/Dumb: DRM_IOCTL_MODE_CREATE_DUMB failed!\n" );
+          return DFB_NOVIDEOMEMORY;
+     }
+
+     alloc->handle = creq.handle;
+     alloc->pitch  = creq.pitch;
+     alloc->size   = creq.size;
+
+     handles[0] = alloc->handle;
+     strides[0] = alloc->pitch;
+
+     if (drmModeAddFB2( egl->fd, creq.width, creq.height, dumb_format( buffer->format ), handles, strides, offsets,
+                        &alloc->fb_id, 0 )) {
+          D_PERROR( "EGL/Dumb: drmModeAddFB2() failed!\n" );
+          goto error;
+     }
+
+     memset( &mreq, 0, sizeof(mreq) );
+     mreq.handle = alloc->handle;
+
+     if (drmIoctl( egl->fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq )) {
+          D_PERROR( "EGL/Dumb: DRM_IOCTL_MODE_MAP_DUMB failed!\n" );
+          goto error;
+     }
+
+     alloc->addr = mmap( NULL, alloc->size, PROT_READ | PROT_WRITE, MAP_SHARED, egl->fd, mreq.offset );
+     if (alloc->addr == MAP_FAILED) {
+          D_PERROR( "EGL/Dumb: mmap() failed!\n" );
+          alloc->addr = NULL;
+          goto error;
+     }
+
+     D_DEBUG_AT( EGL_Dumb, "  -> pitch %d\n", alloc->pitch );
+     D_DEBUG_AT( EGL_Dumb, "  -> size  %d\n", alloc->size );
+     D_DEBUG_AT( EGL_Dumb, "  -> fb    %u\n", alloc->fb_id );
+
+     allocation->size   = alloc->size;
+     allocation->offset = -1;
+
+     D_MAGIC_SET( alloc, EGLDumbAllocationData );
+
+     return DFB_OK;
+
+error:
+     if (alloc->fb_id)
+          drmModeRmFB( egl->fd, alloc->fb_id );
+
+     memset( &dreq, 0, sizeof(dreq) );
+     dreq.handle = alloc->handle;
+
+     drmIoctl( egl->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq );
+
+     return DFB_FAILURE;
+}
+
+static DFBResult
+eglDumbDeallocateBuffer( CoreSurfacePool       *pool,
+                         void                  *pool_data,
+                         void                  *pool_local,
+                         CoreSurfaceBuffer     *buffer,
+                         CoreSurfaceAllocation *allocation,
+                         void                  *alloc_data )
+{
+     EGLDumbPoolLocalData         *local = pool_local;
+     EGLDumbAllocationData        *alloc = alloc_data;
+     EGLData                      *egl;
+     struct drm_mode_destroy_dumb  dreq;
+
+     D_DEBUG_AT( EGL_Dumb, "%s( %p )\n", __FUNCTION__, buffer );
+
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+     D_MAGIC_ASSERT( alloc, EGLDumbAllocationData );
+
+     egl = local->egl;
+
+     munmap( alloc->addr, alloc->size );
+
+     drmModeRmFB( egl->fd, alloc->fb_id );
+
+     memset( &dreq, 0, sizeof(dreq) );
+     dreq.handle = alloc->handle;
+
+     drmIoctl( egl->fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq );
+
+     D_MAGIC_CLEAR( alloc );
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbLock( CoreSurfacePool       *pool,
+             void                  *pool_data,
+             void                  *pool_local,
+             CoreSurfaceAllocation *allocation,
+             void                  *alloc_data,
+             CoreSurfaceBufferLock *lock )
+{
+     EGLDumbAllocationData *alloc = alloc_data;
+
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_MAGIC_ASSERT( allocation, CoreSurfaceAllocation );
+     D_MAGIC_ASSERT( alloc, EGLDumbAllocationData );
+     D_MAGIC_ASSERT( lock, CoreSurfaceBufferLock );
+
+     D_DEBUG_AT( EGL_Dumb, "%s( %p, %p )\n", __FUNCTION__, allocation, lock->buffer );
+
+     lock->pitch  = alloc->pitch;
+     lock->offset = ~0;
+     lock->addr   = alloc->addr;
+     lock->phys   = 0;
+
+     /* The primary layer flips to the framebuffer. */
+     lock->handle = (void*)(uintptr_t) alloc->fb_id;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglDumbUnlock( CoreSurfacePool       *pool,
+               void                  *pool_data,
+               void                  *pool_local,
+               CoreSurfaceAllocation *allocation,
+               void                  *alloc_data,
+               CoreSurfaceBufferLock *lock )
+{
+     D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_MAGIC_ASSERT( allocation, CoreSurfaceAllocation );
+     D_MAGIC_ASSERT( lock, CoreSurfaceBufferLock );
+
+     D_DEBUG_AT( EGL_Dumb, "%s( %p, %p )\n", __FUNCTION__, allocation, lock->buffer );
+
+     return DFB_OK;
+}
+
+const SurfacePoolFuncs eglDumbSurfacePoolFuncs = {
+     .PoolLocalDataSize  = eglDumbPoolLocalDataSize,
+     .AllocationDataSize = eglDumbAllocationDataSize,
+     .InitPool           = eglDumbInitPool,
+     .JoinPool           = eglDumbJoinPool,
+     .DestroyPool        = eglDumbDestroyPool,
+     .LeavePool          = eglDumbLeavePool,
+     .TestConfig         = eglDumbTestConfig,
+     .AllocateBuffer     = eglDumbAllocateBuffer,
+     .DeallocateBuffer   = eglDumbDeallocateBuffer,
+     .Lock               = eglDumbLock,
+     .Unlock             = eglDumbUnlock
+};
@@ -0,0 +1,366 @@
+/*
+   This file is part of DirectFB.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include "egl_system.h"
+
+/*
+ * ETC2 encoding of idle surfaces. Color blocks only use the individual and differential modes inherited from ETC1,
+ * which ETC2 decodes unchanged as long as the differential colors do not overflow. Alpha blocks use EAC. The decoder
+ * handles the blocks produced by the encoder only.
+ */
+
+static const int etc_modifiers[8][2] = {
+     {  2,   8 }, {  5,  17 }, {  9,  29 }, { 13,  42 },
+     { 18,  60 }, { 24,  80 }, { 33, 106 }, { 47, 183 }
+};
+
+static const int eac_modifiers[16][8] = {
+     { -3, -6,  -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 },
+     { -2, -5,  -8, -13, 1, 4, 7, 12 }, { -2, -4,  -6, -13, 1, 3, 5, 12 },
+     { -3, -6,  -8, -12, 2, 5, 7, 11 }, { -3, -7,  -9, -11, 2, 6, 8, 10 },
+     { -4, -7,  -8, -11, 3, 6, 7, 10 }, { -3, -5,  -8, -11, 2, 4, 7, 10 },
+     { -2, -6,  -8, -10, 1, 5, 7,  9 }, { -2, -5,  -8, -10, 1, 4, 7,  9 },
+     { -2, -4,  -8, -10, 1, 3, 7,  9 }, { -2, -5,  -7, -10, 1, 4, 6,  9 },
+     { -3, -4,  -7, -10, 2, 3, 6,  9 }, { -1, -2,  -3, -10, 0, 1, 2,  9 },
+     { -4, -6,  -8,  -9, 3, 5, 7,  8 }, { -3, -5,  -7,  -9, 2, 4, 6,  8 }
+};
+
+/**********************************************************************************************************************/
+
+static inline int
+clamp255( int value )
+{
+     return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+static inline void
+put_be64( u8  *dst,
+          u64  value )
+{
+     int i;
+
+     for (i = 0; i < 8; i++)
+          dst[i] = value >> (56 - i * 8);
+}
+
+static inline u64
+get_be64( const u8 *src )
+{
+     u64 value = 0;
+     int i;
+
+     for (i = 0; i < 8; i++)
+          value = value << 8 | src[i];
+
+     return value;
+}
+
+/* Pixels of a block are indexed column by column, as the index bits of both block types. */
+static inline int
+subblock( int i,
+          int flip )
+{
+     return flip ? (i & 3) >= 2 : (i >> 2) >= 2;
+}
+
+static unsigned int
+etc_fit_subblock( const u8  block[16][4],
+                  int       flip,
+                  int       sub,
+                  const int base[3],
+                  int      *ret_table,
+                  u32      *ret_indices )
+{
+     unsigned int best = ~0u;
+     int          t, i, m;
+
+     for (t = 0; t < 8; t++) {
+          unsigned int error   = 0;
+          u32          indices = 0;
+
+          for (i = 0; i < 16; i++) {
+               unsigned int best_error = ~0u;
+               int          best_m     = 0;
+
+               if (subblock( i, flip ) != sub)
+                    continue;
+
+               /* Index bits: the LSB selects the large modifier, the MSB negates it. */
+               for (m = 0; m < 4; m++) {
+                    int          d = etc_modifiers[t][m & 1] * (m & 2 ? -1 : 1);
+                    int          r = clamp255( base[0] + d ) - block[i][0];
+                    int          g = clamp255( base[1] + d ) - block[i][1];
+                    int          b = clamp255( base[2] + d ) - block[i][2];
+                    unsigned int e = r * r + g * g + b * b;
+
+                    if (e < best_error) {
+                         best_error = e;
+                         best_m     = m;
+                    }
+               }
+
+               error   += best_error;
+               indices |= (u32) (best_m >> 1) << (16 + i) | (u32) (best_m & 1) << i;
+          }
+
+          if (error < best) {
+               best         = error;
+               *ret_table   = t;
+               *ret_indices = indices;
+          }
+     }
+
+     return best;
+}
+
+static u64
+etc_encode_color( const u8 block[16][4] )
+{
+     unsigned int best_error = ~0u;
+     u64          best       = 0;
+     int          flip, s, c, i;
+
+     for (flip = 0; flip < 2; flip++) {
+          int          avg[2][3] = { { 0 } };
+          int          q[2][3];
+          int          base[2][3];
+          int          table[2];
+          u32          indices[2];
+          bool         diff = true;
+          unsigned int error;
+          u64          word;
+
+          for (i = 0; i < 16; i++)
+               for (c = 0; c < 3; c++)
+                    avg[subblock( i, flip )][c] += block[i][c];
+
+          for (s = 0; s < 2; s++)
+               for (c = 0; c < 3; c++) {
+                    avg[s][c] = (avg[s][c] + 4) / 8;
+                    q[s][c]   = (avg[s][c] * 31 + 127) / 255;
+               }
+
+          for (c = 0; c < 3; c++)
+               if (q[1][c] - q[0][c] < -4 || q[1][c] - q[0][c] > 3)
+                    diff = false;
+
+          for (s = 0; s < 2; s++)
+               for (c = 0; c < 3; c++) {
+                    if (diff) {
+                         base[s][c] = q[s][c] << 3 | q[s][c] >> 2;
+                    }
+                    else {
+                         q[s][c]    = (avg[s][c] * 15 + 127) / 255;
+                         base[s][c] = q[s][c] << 4 | q[s][c];
+                    }
+               }
+
+          error = etc_fit_subblock( block, flip, 0, base[0], &table[0], &indices[0] ) +
+                  etc_fit_subblock( block, flip, 1, base[1], &table[1], &indices[1] );
+
+          if (error >= best_error)
+               continue;
+
+          word = 0;
+
+          for (c = 0; c < 3; c++) {
+               if (diff)
+                    word |= (u64) q[0][c] << (59 - c * 8) | (u64) ((q[1][c] - q[0][c]) & 7) << (56 - c * 8);
+               else
+                    word |= (u64) q[0][c] << (60 - c * 8) | (u64) q[1][c] << (56 - c * 8);
+          }
+
+          word |= (u64) table[0] << 37 | (u64) table[1] << 34 | (u64) diff << 33 | (u64) flip << 32;
+          word |= indices[0] | indices[1];
+
+          best_error = error;
+          best       = word;
+     }
+
+     return best;
+}
+
+static void
+etc_decode_color( u64 word,
+                  u8  block[16][4] )
+{
+     int base[2][3];
+     int table[2] = { word >> 37 & 7, word >> 34 & 7 };
+     int flip     = word >> 32 & 1;
+     int c, i;
+
+     for (c = 0; c < 3; c++) {
+          if (word >> 33 & 1) {
+               int q = word >> (59 - c * 8) & 31;
+               int d = ((word >> (56 - c * 8) & 7) ^ 4) - 4;
+
+               base[0][c] = q << 3 | q >> 2;
+               base[1][c] = (q + d) << 3 | (q + d) >> 2;
+          }
+          else {
+               base[0][c] = (word >> (60 - c * 8) & 15) * 17;
+               base[1][c] = (word >> (56 - c * 8) & 15) * 17;
+          }
+     }
+
+     for (i = 0; i < 16; i++) {
+          int s = subblock( i, flip );
+          int d = etc_modifiers[table[s]][word >> i & 1] * (word >> (16 + i) & 1 ? -1 : 1);
+
+          for (c = 0; c < 3; c++)
+               block[i][c] = clamp255( base[s][c] + d );
+     }
+}
+
+static u64
+eac_encode_alpha( const u8 block[16][4] )
+{
+     unsigned int best_error = ~0u;
+     u64          best       = 0;
+     int          min        = 255;
+     int          max        = 0;
+     int          t, m, i, k;
+
+     for (i = 0; i < 16; i++) {
+          min = MIN( min, block[i][3] );
+          max = MAX( max, block[i][3] );
+     }
+
+     for (t = 0; t < 16; t++) {
+          int lo    = eac_modifiers[t][3];
+          int hi    = eac_modifiers[t][7];
+          int guess = (max - min + (hi - lo) / 2) / (hi - lo);
+
+          /* A multiplier of zero is avoided, its meaning differs between the EAC variants. */
+          for (m = MAX( guess - 1, 1 ); m <= MIN( guess + 1, 15 ); m++) {
+               int          base    = clamp255( (min + max - (lo + hi) * m + 1) / 2 );
+               unsigned int error   = 0;
+               u64          indices = 0;
+
+               for (i = 0; i < 16; i++) {
+                    unsigned int best_e = ~0u;
+                    int          best_k = 0;
+
+                    for (k = 0; k < 8; k++) {
+                         int          d = clamp255( base + eac_modifiers[t][k] * m ) - block[i][3];
+                         unsigned int e = d * d;
+
+                         if (e < best_e) {
+                              best_e = e;
+                              best_k = k;
+                         }
+                    }
+
+                    error   += best_e;
+                    indices |= (u64) best_k << (45 - i * 3);
+               }
+
+               if (error < best_error) {
+                    best_error = error;
+                    best       = (u64) base << 56 | (u64) m << 52 | (u64) t << 48 | indices;
+               }
+          }
+     }
+
+     return best;
+}
+
+static void
+eac_decode_alpha( u64 word,
+                  u8  block[16][4] )
+{
+     int base = word >> 56;
+     int m    = word >> 52 & 15;
+     int t    = word >> 48 & 15;
+     int i;
+
+     for (i = 0; i < 16; i++)
+          block[i][3] = clamp255( base + eac_modifiers[t][word >> (45 - i * 3) & 7] * m );
+}
+
+/**********************************************************************************************************************/
+
+size_t
+egl_etc2_size( int  width,
+               int  height,
+               bool alpha )
+{
+     return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * (alpha ? 16 : 8);
+}
+
+void
+egl_etc2_encode( const u8 *rgba,
+                 int       pitch,
+                 int       width,
+                 int       height,
+                 bool      alpha,
+                 u8       *blocks )
+{
+     u8  block[16][4];
+     int bx, by, x, y;
+
+     for (by = 0; by < height; by += 4) {
+          for (bx = 0; bx < width; bx += 4) {
+               /* Partial blocks repeat the last row and column. */
+               for (x = 0; x < 4; x++)
+                    for (y = 0; y < 4; y++)
+                         memcpy( block[x * 4 + y],
+                                 rgba + MIN( by + y, height - 1 ) * pitch + MIN( bx + x, width - 1 ) * 4, 4 );
+
+               if (alpha) {
+                    put_be64( blocks, eac_encode_alpha( block ) );
+                    blocks += 8;
+               }
+
+               put_be64( blocks, etc_encode_color( block ) );
+               blocks += 8;
+          }
+     }
+}
+
+void
+egl_etc2_decode( const u8 *blocks,
+                 int       width,
+                 int       height,
+                 bool      alpha,
+                 u8       *rgba,
+                 int       pitch )
+{
+     u8  block[16][4];
+     int bx, by, x, y;
+
+     for (by = 0; by < height; by += 4) {
+          for (bx = 0; bx < width; bx += 4) {
+               if (alpha) {
+                    eac_decode_alpha( get_be64( blocks ), block );
+                    blocks += 8;
+               }
+               else {
+                    for (x = 0; x < 16; x++)
+                         block[x][3] = 0xff;
+               }
+
+               etc_decode_color( get_be64( blocks ), block );
+               blocks += 8;
+
+               for (x = 0; x < 4 && bx + x < width; x++)
+                    for (y = 0; y < 4 && by + y < height; y++)
+                         memcpy( rgba + (by + y) * pitch + (bx + x) * 4, block[x * 4 + y], 4 );
+          }
+     }
+}
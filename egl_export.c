@@ -0,0 +1,314 @@
+/*
+   This file is part of DirectFB.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include <direct/util.h>
+#include <errno.h>
+#include <misc/util.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "egl_system.h"
+
+D_DEBUG_DOMAIN( EGL_Export, "EGL/Export", "EGL Export" );
+
+/**********************************************************************************************************************/
+
+struct _EGLExport {
+     int            listen_fd;
+     int            client_fd;         /* connected consumer or -1 */
+     char           path[108];
+
+     uint32_t       sequence;          /* sequence of the last exported frame */
+
+     struct gbm_bo *held;              /* buffer held by the consumer */
+     bool           release_pending;   /* the held buffer is no longer on screen */
+
+     DFBRegion      damage;            /* damage accumulated over frames not exported */
+     bool           damaged;
+};
+
+/**********************************************************************************************************************/
+
+static void
+egl_export_drop( EGLData *egl )
+{
+     EGLExport *export = egl->export;
+
+     if (export->held && export->release_pending)
+          gbm_surface_release_buffer( egl->gbm_surface, export->held );
+
+     export->held            = NULL;
+     export->release_pending = false;
+}
+
+static void
+egl_export_disconnect( EGLData *egl )
+{
+     EGLExport *export = egl->export;
+
+     D_INFO( "EGL/Export: Consumer disconnected\n" );
+
+     close( export->client_fd );
+
+     export->client_fd = -1;
+
+     egl_export_drop( egl );
+}
+
+static void
+egl_export_service( EGLData *egl )
+{
+     EGLExport        *export = egl->export;
+     EGLExportRelease  release;
+     ssize_t           len;
+     struct ucred      cred;
+     socklen_t         cred_len = sizeof(cred);
+
+     if (export->client_fd == -1) {
+          export->client_fd = accept4( export->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC );
+          if (export->client_fd == -1)
+               return;
+
+          /* Only processes of the same user or of root are authorized. */
+          if (getsockopt( export->client_fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len ) ||
+              (cred.uid && cred.uid != geteuid())) {
+               D_ERROR( "EGL/Export: Consumer is not authorized!\n" );
+               close( export->client_fd );
+               export->client_fd = -1;
+               return;
+          }
+
+          D_INFO( "EGL/Export: Consumer connected (pid %d)\n", cred.pid );
+
+          export->damaged = false;
+     }
+
+     /* Release messages of the consumer. */
+     while ((len = recv( export->client_fd, &release, sizeof(release), 0 )) != -1) {
+          if (len == 0) {
+               egl_export_disconnect( egl );
+               return;
+          }
+
+          if (len == sizeof(release) && release.magic == EGL_EXPORT_MAGIC && release.sequence == export->sequence) {
+               D_DEBUG_AT( EGL_Export, "  -> frame %u released\n", release.sequence );
+
+               egl_export_drop( egl );
+          }
+     }
+
+     if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+          egl_export_disconnect( egl );
+}
+
+/**********************************************************************************************************************/
+
+DFBResult
+egl_export_init( EGLData    *egl,
+                 const char *path )
+{
+     EGLExport          *export;
+     struct sockaddr_un  addr;
+
+     D_DEBUG_AT( EGL_Export, "%s( '%s' )\n", __FUNCTION__, path );
+
+     export = D_CALLOC( 1, sizeof(EGLExport) );
+     if (!export)
+          return D_OOM();
+
+     export->client_fd = -1;
+
+     export->listen_fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+     if (export->listen_fd < 0) {
+          D_PERROR( "EGL/Export: socket() failed!\n" );
+          D_FREE( export );
+          return DFB_IO;
+     }
+
+     memset( &addr, 0, sizeof(addr) );
+     addr.sun_family = AF_UNIX;
+     direct_snputs( addr.sun_path, path, sizeof(addr.sun_path) );
+     direct_snputs( export->path, path, sizeof(export->path) );
+
+     unlink( export->path );
+
+     if (bind( export->listen_fd, (struct sockaddr*) &addr, sizeof(addr) ) || listen( export->listen_fd, 1 )) {
+          D_PERROR( "EGL/Export: Failed to listen on '%s'!\n", path );
+          close( export->listen_fd );
+          D_FREE( export );
+          return DFB_IO;
+     }
+
+     D_INFO( "EGL/Export: Exporting frames on %s\n", path );
+
+     egl->export = export;
+
+     return DFB_OK;
+}
+
+void
+egl_export_deinit( EGLData *egl )
+{
+     EGLExport *export = egl->export;
+
+     D_DEBUG_AT( EGL_Export, "%s()\n", __FUNCTION__ );
+
+     if (export->client_fd != -1)
+          close( export->client_fd );
+
+     close( export->listen_fd );
+
+     unlink( export->path );
+
+     D_FREE( export );
+
+     egl->export = NULL;
+}
+
+void
+egl_export_frame( EGLData         *egl,
+                  struct gbm_bo   *bo,
+                  int              fence,
+                  const DFBRegion *damage )
+{
+     EGLExport      *export = egl->export;
+     EGLExportFrame  frame;
+     int             fds[5];
+     int             num_fds = 0;
+     char            control[CMSG_SPACE(sizeof(fds))];
+     struct iovec    iov     = { &frame, sizeof(frame) };
+     struct msghdr   msg;
+     struct cmsghdr *cmsg;
+     int             i;
+
+     egl_export_service( egl );
+
+     if (export->client_fd == -1)
+          return;
+
+     if (export->damaged)
+          dfb_region_region_union( &export->damage, damage );
+     else
+          export->damage = *damage;
+
+     export->damaged = true;
+
+     /* The consumer still holds the previous frame, this one is skipped and its damage is carried over. */
+     if (export->held) {
+          D_DEBUG_AT( EGL_Export, "  -> frame %u still held\n", export->sequence );
+          return;
+     }
+
+     memset( &frame, 0, sizeof(frame) );
+
+     frame.magic    = EGL_EXPORT_MAGIC;
+     frame.sequence = export->sequence + 1;
+     frame.width    = gbm_bo_get_width( bo );
+     frame.height   = gbm_bo_get_height( bo );
+     frame.format   = gbm_bo_get_format( bo );
+     frame.modifier = gbm_bo_get_modifier( bo );
+     frame.planes   = gbm_bo_get_plane_count( bo );
+     frame.damage   = export->damage;
+
+     for (i = 0; i < frame.planes; i++) {
+          frame.offsets[i] = gbm_bo_get_offset( bo, i );
+          frame.strides[i] = gbm_bo_get_stride_for_plane( bo, i );
+
+          fds[num_fds] = gbm_bo_get_fd_for_plane( bo, i );
+          if (fds[num_fds] < 0) {
+               D_ERROR( "EGL/Export: gbm_bo_get_fd_for_plane() failed!\n" );
+               goto out;
+          }
+
+          num_fds++;
+     }
+
+     /* The consumer waits for the rendering to complete before reading the buffer. */
+     if (fence != -1) {
+          frame.fence = 1;
+
+          fds[num_fds++] = fence;
+     }
+
+     memset( &msg, 0, sizeof(msg) );
+     msg.msg_iov        = &iov;
+     msg.msg_iovlen     = 1;
+     msg.msg_control    = control;
+     msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+
+     cmsg = CMSG_FIRSTHDR( &msg );
+     cmsg->cmsg_level = SOL_SOCKET;
+     cmsg->cmsg_type  = SCM_RIGHTS;
+     cmsg->cmsg_len   = CMSG_LEN(num_fds * sizeof(int));
+     memcpy( CMSG_DATA(cmsg), fds, num_fds * sizeof(int) );
+
+     if (sendmsg( export->client_fd, &msg, MSG_NOSIGNAL ) < 0) {
+          if (errno != EAGAIN && errno != EWOULDBLOCK)
+               egl_export_disconnect( egl );
+     }
+     else {
+          D_DEBUG_AT( EGL_Export, "  -> frame %u exported\n", frame.sequence );
+
+          export->sequence = frame.sequence;
+          export->held     = bo;
+          export->damaged  = false;
+     }
+
+out:
+     /* The fence belongs to the caller. */
+     if (frame.fence)
+          num_fds--;
+
+     for (i = 0; i < num_fds; i++)
+          close( fds[i] );
+}
+
+bool
+egl_export_release( EGLData       *egl,
+                    struct gbm_bo *bo )
+{
+     EGLExport *export = egl->export;
+
+     if (!export)
+          return false;
+
+     egl_export_service( egl );
+
+     if (export->held != bo)
+          return false;
+
+     /* The buffer goes back to the surface when the consumer releases it. */
+     export->release_pending = true;
+
+     return true;
+}
+
+void
+egl_export_reset( EGLData *egl )
+{
+     EGLExport *export = egl->export;
+
+     if (!export)
+          return;
+
+     /* The buffers are destroyed with the scanout surface, the consumer's dma-buf references remain valid. */
+     export->held            = NULL;
+     export->release_pending = false;
+     export->damaged         = false;
+}
@@ -17,6 +17,9 @@
 */
 
 #include <core/layers.h>
+#include <core/surface.h>
+#include <errno.h>
+#include <poll.h>
 
 #include "egl_system.h"
 
@@ -24,11 +27,732 @@ D_DEBUG_DOMAIN( EGL_Layer, "EGL/Layer", "EGL Layer" );
 
 /**********************************************************************************************************************/
 
+typedef struct {
+     int      fd;                  /* display device of the framebuffer */
+     uint32_t fb_id;
+} EGLBoFramebuffer;
+
 static void
 egl_destroy_user_data( struct gbm_bo *bo,
                        void          *data )
 {
-     drmModeRmFB( gbm_device_get_fd( gbm_bo_get_device( bo ) ), (uintptr_t) data );
+     EGLBoFramebuffer *fb = data;
+
+     /* The framebuffer belongs to the display device, which may not be the device of the buffer. */
+     drmModeRmFB( fb->fd, fb->fb_id );
+
+     D_FREE( fb );
+}
+
+static bool
+egl_bo_import( EGLData       *egl,
+               struct gbm_bo *bo,
+               uint32_t      *handles )
+{
+     int fd, i;
+
+     for (i = 0; i < gbm_bo_get_plane_count( bo ); i++) {
+          fd = gbm_bo_get_fd_for_plane( bo, i );
+          if (fd < 0) {
+               D_ERROR( "EGL/Layer: gbm_bo_get_fd_for_plane() failed!\n" );
+               return false;
+          }
+
+          if (drmPrimeFDToHandle( egl->fd, fd, &handles[i] )) {
+               D_PERROR( "EGL/Layer: drmPrimeFDToHandle() failed!\n" );
+               close( fd );
+               return false;
+          }
+
+          close( fd );
+     }
+
+     return true;
+}
+
+static void
+egl_bo_close_handles( EGLData  *egl,
+                      uint32_t *handles )
+{
+     struct drm_gem_close gem_close;
+     int                  i, j;
+
+     /* The framebuffer keeps a reference, planes may share a handle. */
+     for (i = 0; i < 4 && handles[i]; i++) {
+          for (j = 0; j < i; j++) {
+               if (handles[j] == handles[i])
+                    break;
+          }
+
+          if (j < i)
+               continue;
+
+          memset( &gem_close, 0, sizeof(gem_close) );
+          gem_close.handle = handles[i];
+
+          drmIoctl( egl->fd, DRM_IOCTL_GEM_CLOSE, &gem_close );
+     }
+}
+
+uint32_t
+egl_bo_get_fb( EGLData       *egl,
+               struct gbm_bo *bo )
+{
+     EGLBoFramebuffer *fb           = gbm_bo_get_user_data( bo );
+     uint32_t          fb_id        = 0;
+     uint32_t          handles[4]   = { 0 };
+     uint32_t          strides[4]   = { 0 };
+     uint32_t          offsets[4]   = { 0 };
+     uint64_t          modifiers[4] = { 0 };
+     uint64_t          modifier;
+     int               i;
+
+     if (fb)
+          return fb->fb_id;
+
+     modifier = gbm_bo_get_modifier( bo );
+
+     for (i = 0; i < gbm_bo_get_plane_count( bo ); i++) {
+          handles[i]   = gbm_bo_get_handle_for_plane( bo, i ).u32;
+          strides[i]   = gbm_bo_get_stride_for_plane( bo, i );
+          offsets[i]   = gbm_bo_get_offset( bo, i );
+          modifiers[i] = modifier;
+     }
+
+     /* Buffers of a separate render device are imported on the display device. */
+     if (egl->render_gbm) {
+          memset( handles, 0, sizeof(handles) );
+
+          if (!egl_bo_import( egl, bo, handles )) {
+               egl_bo_close_handles( egl, handles );
+               return 0;
+          }
+     }
+
+     if (egl->num_modifiers && modifier != DRM_FORMAT_MOD_INVALID) {
+          if (drmModeAddFB2WithModifiers( egl->fd, gbm_bo_get_width( bo ), gbm_bo_get_height( bo ),
+                                          gbm_bo_get_format( bo ), handles, strides, offsets, modifiers,
+                                          &fb_id, DRM_MODE_FB_MODIFIERS )) {
+               D_PERROR( "EGL/Layer: drmModeAddFB2WithModifiers() failed!\n" );
+               fb_id = 0;
+          }
+          else
+               D_DEBUG_AT( EGL_Layer, "  -> fb %u with modifier 0x%016llx\n",
+                           fb_id, (unsigned long long) modifier );
+     }
+     else if (drmModeAddFB2( egl->fd, gbm_bo_get_width( bo ), gbm_bo_get_height( bo ), gbm_bo_get_format( bo ),
+                             handles, strides, offsets, &fb_id, 0 )) {
+          D_PERROR( "EGL/Layer: drmModeAddFB2() failed!\n" );
+          fb_id = 0;
+     }
+
+     if (egl->render_gbm)
+          egl_bo_close_handles( egl, handles );
+
+     if (!fb_id)
+          return 0;
+
+     fb = D_MALLOC( sizeof(EGLBoFramebuffer) );
+     if (!fb) {
+          D_OOM();
+          drmModeRmFB( egl->fd, fb_id );
+          return 0;
+     }
+
+     fb->fd    = egl->fd;
+     fb->fb_id = fb_id;
+
+     gbm_bo_set_user_data( bo, fb, egl_destroy_user_data );
+
+     return fb_id;
+}
+
+static void
+egl_release_buffer( EGLData       *egl,
+                    struct gbm_bo *bo )
+{
+     /* A buffer held by the frame consumer is released when the consumer is done with it. */
+     if (!egl_export_release( egl, bo ))
+          gbm_surface_release_buffer( egl->gbm_surface, bo );
+}
+
+void
+egl_wait_out_fence( EGLData *egl )
+{
+     struct pollfd pfd;
+
+     if (egl->out_fence == -1)
+          return;
+
+     /* The fence of the previous commit signals when its buffer is on screen and the buffer before is released. */
+     pfd.fd     = egl->out_fence;
+     pfd.events = POLLIN;
+
+     while (poll( &pfd, 1, -1 ) < 0 && (errno == EINTR || errno == EAGAIN));
+
+     close( egl->out_fence );
+
+     egl->out_fence = -1;
+
+     if (egl->prev_bo) {
+          egl_release_buffer( egl, egl->prev_bo );
+          egl->prev_bo = NULL;
+     }
+
+     /* Commits of a previous scanout surface have completed before it was retired. */
+     egl_destroy_retired( egl );
+}
+
+static bool
+egl_has_color_management( EGLData *egl )
+{
+     return egl->atomic &&
+            egl_kms_property_id( &egl->kms_crtc, "GAMMA_LUT" ) &&
+            egl_kms_property_id( &egl->kms_crtc, "GAMMA_LUT_SIZE" ) &&
+            egl_kms_property_id( &egl->kms_crtc, "CTM" );
+}
+
+static void
+egl_add_color_properties( EGLData          *egl,
+                          drmModeAtomicReq *req )
+{
+     egl_kms_add_property( req, &egl->kms_crtc, "GAMMA_LUT", egl->gamma_blob );
+     egl_kms_add_property( req, &egl->kms_crtc, "CTM",       egl->ctm_blob );
+
+     egl->color_pending = false;
+}
+
+static uint64_t
+ctm_value( double value )
+{
+     /* S31.32 sign-magnitude. */
+     return (value < 0 ? (1ULL << 63) : 0) | (uint64_t) ((value < 0 ? -value : value) * (1ULL << 32));
+}
+
+static void
+egl_add_plane_properties( EGLData          *egl,
+                          drmModeAtomicReq *req,
+                          uint32_t          fb_id,
+                          int               width,
+                          int               height )
+{
+     /* The plane scales the buffer to the display mode. */
+     egl_kms_add_property( req, &egl->kms_plane, "FB_ID",   fb_id );
+     egl_kms_add_property( req, &egl->kms_plane, "CRTC_ID", egl->crtc->crtc_id );
+     egl_kms_add_property( req, &egl->kms_plane, "SRC_X",   0 );
+     egl_kms_add_property( req, &egl->kms_plane, "SRC_Y",   0 );
+     egl_kms_add_property( req, &egl->kms_plane, "SRC_W",   (uint64_t) width << 16 );
+     egl_kms_add_property( req, &egl->kms_plane, "SRC_H",   (uint64_t) height << 16 );
+     egl_kms_add_property( req, &egl->kms_plane, "CRTC_X",  0 );
+     egl_kms_add_property( req, &egl->kms_plane, "CRTC_Y",  0 );
+     egl_kms_add_property( req, &egl->kms_plane, "CRTC_W",  egl->mode_info.hdisplay );
+     egl_kms_add_property( req, &egl->kms_plane, "CRTC_H",  egl->mode_info.vdisplay );
+
+     if (egl->plane_rotation)
+          egl_kms_add_property( req, &egl->kms_plane, "rotation", egl->plane_rotation );
+}
+
+static void
+egl_add_commit_properties( EGLData          *egl,
+                           drmModeAtomicReq *req,
+                           uint32_t          fb_id,
+                           int               width,
+                           int               height,
+                           uint32_t         *flags )
+{
+     if (egl->color_pending)
+          egl_add_color_properties( egl, req );
+
+     if (egl->modeset) {
+          egl_kms_add_property( req, &egl->kms_connector, "CRTC_ID", egl->crtc->crtc_id );
+          egl_kms_add_property( req, &egl->kms_crtc,      "MODE_ID", egl->mode_blob );
+          egl_kms_add_property( req, &egl->kms_crtc,      "ACTIVE",  1 );
+
+          *flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+     }
+
+     egl_add_plane_properties( egl, req, fb_id, width, height );
+
+     if (egl->writeback)
+          egl_writeback_add( egl, req, flags );
+}
+
+bool
+egl_test_scaling( EGLData *egl,
+                  int      width,
+                  int      height )
+{
+     struct gbm_bo    *bo;
+     drmModeAtomicReq *req;
+     uint32_t          fb_id;
+     uint32_t          handles[4] = { 0 };
+     uint32_t          strides[4] = { 0 };
+     uint32_t          offsets[4] = { 0 };
+     int               err;
+
+     bo = gbm_bo_create( egl->gbm, width, height, egl->format, GBM_BO_USE_SCANOUT );
+     if (!bo) {
+          D_DEBUG_AT( EGL_Layer, "  -> gbm_bo_create() failed\n" );
+          return false;
+     }
+
+     handles[0] = gbm_bo_get_handle( bo ).u32;
+     strides[0] = gbm_bo_get_stride( bo );
+
+     if (drmModeAddFB2( egl->fd, width, height, egl->format, handles, strides, offsets, &fb_id, 0 )) {
+          D_DEBUG_AT( EGL_Layer, "  -> drmModeAddFB2() failed\n" );
+          gbm_bo_destroy( bo );
+          return false;
+     }
+
+     req = drmModeAtomicAlloc();
+
+     egl_kms_add_property( req, &egl->kms_connector, "CRTC_ID", egl->crtc->crtc_id );
+     egl_kms_add_property( req, &egl->kms_crtc,      "MODE_ID", egl->mode_blob );
+     egl_kms_add_property( req, &egl->kms_crtc,      "ACTIVE",  1 );
+
+     egl_add_plane_properties( egl, req, fb_id, width, height );
+
+     err = drmModeAtomicCommit( egl->fd, req, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET, NULL );
+
+     D_DEBUG_AT( EGL_Layer, "  -> scaling %dx%d to %dx%d %s\n", width, height,
+                 egl->mode_info.hdisplay, egl->mode_info.vdisplay, err ? "rejected" : "accepted" );
+
+     drmModeAtomicFree( req );
+     drmModeRmFB( egl->fd, fb_id );
+     gbm_bo_destroy( bo );
+
+     return !err;
+}
+
+static DFBResult
+egl_present_atomic( EGLData         *egl,
+                    const DFBRegion *damage )
+{
+     DFBResult         ret      = DFB_OK;
+     EGLSyncKHR        sync     = EGL_NO_SYNC_KHR;
+     int               in_fence = -1;
+     uint32_t          flags    = 0;
+     drmModeAtomicReq *req;
+     struct gbm_bo    *bo;
+     uint32_t          fb_id;
+     int               err;
+     const EGLint      sync_attr[] = { EGL_SYNC_NATIVE_FENCE_FD_ANDROID, EGL_NO_NATIVE_FENCE_FD_ANDROID,
+                                       EGL_NONE };
+
+     /* Do not queue a commit while the previous one is pending, this does not wait for GPU completion. */
+     egl_wait_out_fence( egl );
+
+     if (egl->explicit_sync)
+          sync = egl->eglCreateSyncKHR( egl->eglDisplay, EGL_SYNC_NATIVE_FENCE_ANDROID, sync_attr );
+
+     eglSwapBuffers( egl->eglDisplay, egl->eglSurface );
+
+     if (sync) {
+          /* The native fence fd is available once the swap has flushed the rendering commands. */
+          in_fence = egl->eglDupNativeFenceFDANDROID( egl->eglDisplay, sync );
+
+          egl->eglDestroySyncKHR( egl->eglDisplay, sync );
+     }
+
+     bo = gbm_surface_lock_front_buffer( egl->gbm_surface );
+     if (!bo) {
+          if (in_fence != -1)
+               close( in_fence );
+
+          return DFB_FAILURE;
+     }
+
+     fb_id = egl_bo_get_fb( egl, bo );
+
+     if (egl->export)
+          egl_export_frame( egl, bo, in_fence, damage );
+
+     req = drmModeAtomicAlloc();
+
+     egl_add_commit_properties( egl, req, fb_id, gbm_bo_get_width( bo ), gbm_bo_get_height( bo ), &flags );
+
+     if (egl->explicit_sync) {
+          if (in_fence != -1)
+               egl_kms_add_property( req, &egl->kms_plane, "IN_FENCE_FD", in_fence );
+
+          egl_kms_add_property( req, &egl->kms_crtc, "OUT_FENCE_PTR", (uintptr_t) &egl->out_fence );
+
+          /* Completion is signaled by the out fence. */
+          flags |= DRM_MODE_ATOMIC_NONBLOCK;
+     }
+
+     err = drmModeAtomicCommit( egl->fd, req, flags, NULL );
+
+     /* A commit of a lessee on the shared CRTC may still be pending, a blocking commit waits for it. */
+     if (err && errno == EBUSY && (flags & DRM_MODE_ATOMIC_NONBLOCK)) {
+          D_DEBUG_AT( EGL_Layer, "  -> CRTC busy, retrying a blocking commit\n" );
+
+          err = drmModeAtomicCommit( egl->fd, req, flags & ~DRM_MODE_ATOMIC_NONBLOCK, NULL );
+     }
+
+     if (err) {
+          D_PERROR( "EGL/Layer: drmModeAtomicCommit() failed!\n" );
+
+          egl->out_fence = -1;
+
+          egl_release_buffer( egl, bo );
+
+          ret = DFB_FAILURE;
+     }
+     else {
+          egl->modeset = false;
+
+          if (egl->front_bo) {
+               /* A blocking commit has already released the previous buffer. */
+               if (egl->out_fence != -1)
+                    egl->prev_bo = egl->front_bo;
+               else
+                    egl_release_buffer( egl, egl->front_bo );
+          }
+
+          egl->front_bo = bo;
+          egl->front_fb = fb_id;
+
+          if (egl->out_fence == -1)
+               egl_destroy_retired( egl );
+     }
+
+     if (egl->writeback)
+          egl_writeback_committed( egl, ret == DFB_OK );
+
+     drmModeAtomicFree( req );
+
+     if (in_fence != -1)
+          close( in_fence );
+
+     return ret;
+}
+
+/*
+ * Updates without a write to the primary layer since the last present are skipped. After the eglgbm-idle-refresh
+ * time without changes, a thread switches the display to a lower refresh rate until the next change.
+ */
+
+static bool
+egl_is_unchanged( EGLData *egl )
+{
+     return egl->idle_skip && !egl->dirty && !egl->modeset && !egl->color_pending &&
+            (!egl->writeback || !egl_writeback_requested( egl ));
+}
+
+static void
+egl_enter_idle( EGLData *egl )
+{
+     drmModeAtomicReq *req;
+     drmModeCrtc      *crtc;
+     int               err;
+
+     /* Dumb buffer presents do not restore the mode, a pending mode set has no frame on screen yet. */
+     if (egl->dumb || egl->idle || egl->modeset || egl->suspended)
+          return;
+
+     if (egl->atomic) {
+          egl_wait_out_fence( egl );
+
+          req = drmModeAtomicAlloc();
+
+          egl_kms_add_property( req, &egl->kms_crtc, "MODE_ID", egl->idle_blob );
+
+          err = drmModeAtomicCommit( egl->fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL );
+
+          drmModeAtomicFree( req );
+     }
+     else {
+          /* The buffer on screen stays. */
+          crtc = drmModeGetCrtc( egl->fd, egl->crtc->crtc_id );
+          if (!crtc)
+               return;
+
+          err = drmModeSetCrtc( egl->fd, egl->crtc->crtc_id, crtc->buffer_id, 0, 0, &egl->connector->connector_id, 1,
+                                &egl->idle_mode );
+
+          drmModeFreeCrtc( crtc );
+     }
+
+     /* The thread then waits until it is stopped. */
+     if (err) {
+          D_PERROR( "EGL/Layer: Could not switch to the idle mode!\n" );
+          egl->idle_time = 0;
+          return;
+     }
+
+     D_DEBUG_AT( EGL_Layer, "  -> idle at %d Hz\n", egl->idle_mode.vrefresh );
+
+     egl->idle = true;
+}
+
+static void *
+egl_idle_loop( DirectThread *thread,
+               void         *arg )
+{
+     EGLData   *egl = arg;
+     long long  remaining;
+
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
+
+     direct_mutex_lock( &egl->idle_lock );
+
+     while (!egl->idle_stop) {
+          if (!egl->idle_time) {
+               direct_waitqueue_wait( &egl->idle_cond, &egl->idle_lock );
+               continue;
+          }
+
+          remaining = egl->last_change + egl->idle_time - direct_clock_get_abs_micros();
+
+          if (remaining <= 0) {
+               egl_enter_idle( egl );
+
+               remaining = egl->idle_time;
+          }
+
+          direct_waitqueue_wait_timeout( &egl->idle_cond, &egl->idle_lock, remaining );
+     }
+
+     direct_mutex_unlock( &egl->idle_lock );
+
+     return NULL;
+}
+
+void
+egl_idle_start( EGLData *egl )
+{
+     direct_mutex_init( &egl->idle_lock );
+     direct_waitqueue_init( &egl->idle_cond );
+
+     egl->idle_thread = direct_thread_create( DTT_DEFAULT, egl_idle_loop, egl, "EGL Idle" );
+     if (!egl->idle_thread) {
+          direct_waitqueue_deinit( &egl->idle_cond );
+          direct_mutex_deinit( &egl->idle_lock );
+
+          egl->idle_time = 0;
+     }
+}
+
+/* Taken by every commit consuming the fence or the buffers of the previous one. */
+void
+egl_idle_lock( EGLData *egl )
+{
+     if (egl->idle_thread)
+          direct_mutex_lock( &egl->idle_lock );
+}
+
+void
+egl_idle_unlock( EGLData *egl )
+{
+     if (egl->idle_thread)
+          direct_mutex_unlock( &egl->idle_lock );
+}
+
+void
+egl_idle_stop( EGLData *egl )
+{
+     direct_mutex_lock( &egl->idle_lock );
+
+     egl->idle_stop = true;
+
+     direct_waitqueue_broadcast( &egl->idle_cond );
+
+     direct_mutex_unlock( &egl->idle_lock );
+
+     direct_thread_join( egl->idle_thread );
+     direct_thread_destroy( egl->idle_thread );
+
+     egl->idle_thread = NULL;
+
+     direct_waitqueue_deinit( &egl->idle_cond );
+     direct_mutex_deinit( &egl->idle_lock );
+}
+
+static DFBResult
+egl_present_legacy( EGLData         *egl,
+                    const DFBRegion *damage )
+{
+     drmEventContext  event_context = { DRM_EVENT_CONTEXT_VERSION, NULL, NULL };
+     struct gbm_bo   *bo;
+     uint32_t         fb_id;
+
+     eglSwapBuffers( egl->eglDisplay, egl->eglSurface );
+
+     bo = gbm_surface_lock_front_buffer( egl->gbm_surface );
+     if (!bo)
+          return DFB_FAILURE;
+
+     fb_id = egl_bo_get_fb( egl, bo );
+
+     if (egl->export)
+          egl_export_frame( egl, bo, -1, damage );
+
+     if (egl->modeset) {
+          drmModeSetCrtc( egl->fd, egl->crtc->crtc_id, fb_id, 0, 0, &egl->connector->connector_id, 1,
+                          &egl->mode_info );
+
+          egl->modeset = false;
+     }
+
+     drmModePageFlip( egl->fd, egl->crtc->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, NULL );
+
+     drmHandleEvent( egl->fd, &event_context );
+
+     egl_release_buffer( egl, bo );
+
+     egl->front_fb = fb_id;
+
+     egl_destroy_retired( egl );
+
+     return DFB_OK;
+}
+
+static DFBResult
+egl_present_dumb( EGLData               *egl,
+                  CoreSurface           *surface,
+                  CoreSurfaceBufferLock *lock )
+{
+     drmEventContext   event_context = { DRM_EVENT_CONTEXT_VERSION, NULL, NULL };
+     uint32_t          fb_id         = lock ? (uintptr_t) lock->handle : 0;
+     uint32_t          flags         = 0;
+     drmModeAtomicReq *req;
+     int               err;
+
+     if (!fb_id)
+          return DFB_BUFFEREMPTY;
+
+     /* A front only buffer stays on screen, updates are visible without a commit. */
+     if (fb_id == egl->dumb_fb && !egl->modeset && !egl->color_pending && !egl->writeback)
+          return DFB_OK;
+
+     if (egl->atomic) {
+          req = drmModeAtomicAlloc();
+
+          egl_add_commit_properties( egl, req, fb_id, surface->config.size.w, surface->config.size.h, &flags );
+
+          /* A blocking commit returns once the previous buffer is no longer scanned out and can be rendered to. */
+          err = drmModeAtomicCommit( egl->fd, req, flags, NULL );
+
+          if (egl->writeback)
+               egl_writeback_committed( egl, !err );
+
+          drmModeAtomicFree( req );
+
+          if (err) {
+               D_PERROR( "EGL/Layer: drmModeAtomicCommit() failed!\n" );
+               return DFB_FAILURE;
+          }
+     }
+     else if (egl->modeset) {
+          if (drmModeSetCrtc( egl->fd, egl->crtc->crtc_id, fb_id, 0, 0, &egl->connector->connector_id, 1,
+                              &egl->mode_info )) {
+               D_PERROR( "EGL/Layer: drmModeSetCrtc() failed!\n" );
+               return DFB_FAILURE;
+          }
+     }
+     else if (fb_id != egl->dumb_fb) {
+          if (drmModePageFlip( egl->fd, egl->crtc->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, NULL )) {
+               D_PERROR( "EGL/Layer: drmModePageFlip() failed!\n" );
+               return DFB_FAILURE;
+          }
+
+          drmHandleEvent( egl->fd, &event_context );
+     }
+
+     egl->modeset = false;
+     egl->dumb_fb = fb_id;
+
+     return DFB_OK;
+}
+
+static DFBResult
+egl_cursor_show( EGLData *egl )
+{
+     if (drmModeSetCursor2( egl->fd, egl->crtc->crtc_id, gbm_bo_get_handle( egl->cursor_bo ).u32,
+                            egl->cursor_size.w, egl->cursor_size.h, 0, 0 )) {
+          D_PERROR( "EGL/Layer: drmModeSetCursor2() failed!\n" );
+          return DFB_FAILURE;
+     }
+
+     drmModeMoveCursor( egl->fd, egl->crtc->crtc_id, egl->cursor_position.x, egl->cursor_position.y );
+
+     return DFB_OK;
+}
+
+static DFBResult
+egl_restore_commit( EGLData *egl )
+{
+     uint32_t          fb_id = egl->dumb ? egl->dumb_fb : egl->front_fb;
+     uint32_t          flags = 0;
+     drmModeAtomicReq *req;
+     drmModeFB        *fb;
+     int               err;
+
+     D_DEBUG_AT( EGL_Layer, "%s( fb %u )\n", __FUNCTION__, fb_id );
+
+     /* Another DRM master may have changed any state, the mode and the colors are set again. */
+     egl->modeset       = true;
+     egl->color_pending = egl_has_color_management( egl );
+     egl->idle          = false;
+     egl->last_change   = direct_clock_get_abs_micros();
+
+     /* Without a frame on screen yet, the next present does it. */
+     if (!fb_id)
+          return DFB_OK;
+
+     fb = drmModeGetFB( egl->fd, fb_id );
+     if (!fb)
+          return DFB_OK;
+
+     if (egl->atomic) {
+          egl_wait_out_fence( egl );
+
+          req = drmModeAtomicAlloc();
+
+          egl_add_commit_properties( egl, req, fb_id, fb->width, fb->height, &flags );
+
+          err = drmModeAtomicCommit( egl->fd, req, flags, NULL );
+
+          if (egl->writeback)
+               egl_writeback_committed( egl, !err );
+
+          drmModeAtomicFree( req );
+     }
+     else {
+          err = drmModeSetCrtc( egl->fd, egl->crtc->crtc_id, fb_id, 0, 0, &egl->connector->connector_id, 1,
+                                &egl->mode_info );
+     }
+
+     drmModeFreeFB( fb );
+
+     if (err) {
+          D_PERROR( "EGL/Layer: Could not restore the display!\n" );
+          return DFB_FAILURE;
+     }
+
+     egl->modeset = false;
+
+     /* The cursor changed while suspended is set as well. */
+     if (egl->cursor_visible)
+          egl_cursor_show( egl );
+
+     return DFB_OK;
+}
+
+DFBResult
+egl_restore_display( EGLData *egl )
+{
+     DFBResult ret;
+
+     egl_idle_lock( egl );
+
+     ret = egl_restore_commit( egl );
+
+     egl_idle_unlock( egl );
+
+     return ret;
 }
 
 /**********************************************************************************************************************/
@@ -62,9 +786,19 @@ eglPrimaryInitLayer( CoreLayer                  *layer,
      config->flags       = DLCONF_WIDTH | DLCONF_HEIGHT | DLCONF_PIXELFORMAT | DLCONF_BUFFERMODE;
      config->width       = dfb_config->mode.width  ?: shared->mode.w;
      config->height      = dfb_config->mode.height ?: shared->mode.h;
-     config->pixelformat = dfb_config->mode.format ?: DSPF_ARGB;
+     config->pixelformat = dfb_config->mode.format ?: (egl->format == GBM_FORMAT_RGB565 ? DSPF_RGB16 : DSPF_ARGB);
      config->buffermode  = DLBM_FRONTONLY;
 
+     /* Color adjustment is done by the display pipeline. */
+     if (egl_has_color_management( egl )) {
+          description->caps |= DLCAPS_BRIGHTNESS | DLCAPS_CONTRAST | DLCAPS_SATURATION;
+
+          adjustment->flags      = DCAF_BRIGHTNESS | DCAF_CONTRAST | DCAF_SATURATION;
+          adjustment->brightness = 0x8000;
+          adjustment->contrast   = 0x8000;
+          adjustment->saturation = 0x8000;
+     }
+
      return DFB_OK;
 }
 
@@ -75,7 +809,9 @@ eglPrimaryTestRegion( CoreLayer                  *layer,
                       CoreLayerRegionConfig      *config,
                       CoreLayerRegionConfigFlags *ret_failed )
 {
-     CoreLayerRegionConfigFlags failed = CLRCF_NONE;
+     EGLData                    *egl    = driver_data;
+     CoreLayerRegionConfigFlags  failed = CLRCF_NONE;
+     uint32_t                    format;
 
      D_DEBUG_AT( EGL_Layer, "%s( %dx%d, %s )\n", __FUNCTION__,
                  config->source.w, config->source.h, dfb_pixelformat_name( config->format ) );
@@ -92,15 +828,10 @@ eglPrimaryTestRegion( CoreLayer                  *layer,
                break;
      }
 
-     switch (config->format) {
-          case DSPF_ARGB:
-          case DSPF_RGB16:
-               break;
-
-          default:
-               failed |= CLRCF_FORMAT;
-               break;
-     }
+     /* Another scanout format needs contexts that can be made current with surfaces of another EGL config. */
+     format = egl_scanout_format( egl, config->format );
+     if (!format || (format != egl->format && !egl->no_config && !egl->dumb && !egl->headless))
+          failed |= CLRCF_FORMAT;
 
      if (config->options)
           failed |= CLRCF_OPTIONS;
@@ -126,11 +857,148 @@ eglPrimarySetRegion( CoreLayer                  *layer,
                      CoreSurfaceBufferLock      *left_lock,
                      CoreSurfaceBufferLock      *right_lock )
 {
+     EGLData  *egl    = driver_data;
+     int       width  = egl->scanout.w;
+     int       height = egl->scanout.h;
+     uint32_t  format = egl->format;
+
      D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
 
+     D_ASSERT( egl != NULL );
+
+     /* Changing the layer size changes the render resolution, the plane keeps scaling to the display mode. */
+     if (egl->plane_scaling && (updated & (CLRCF_WIDTH | CLRCF_HEIGHT))) {
+          D_DEBUG_AT( EGL_Layer, "  -> render resolution %dx%d\n", config->width, config->height );
+
+          width  = config->width;
+          height = config->height;
+     }
+
+     /* The scanout surface follows the pixel format of the layer. */
+     if (updated & CLRCF_FORMAT)
+          format = egl_scanout_format( egl, config->format );
+
+     if (width != egl->scanout.w || height != egl->scanout.h || format != egl->format)
+          return egl_resize_scanout( egl, width, height, format );
+
      return DFB_OK;
 }
 
+static DFBResult
+egl_present_headless( EGLData               *egl,
+                      CoreSurface           *surface,
+                      CoreSurfaceBufferLock *lock )
+{
+     EGLThreadData *thread = egl_thread_data( egl );
+     int            width  = surface->config.size.w;
+     int            height = surface->config.size.h;
+     size_t         size   = (size_t) width * 4 * height;
+     GLuint         fbo;
+
+     D_DEBUG_AT( EGL_Layer, "%s( %dx%d )\n", __FUNCTION__, width, height );
+
+     /* Without a sink the frames are only rendered, e.g. for performance tests. */
+     if (!egl->sink)
+          return DFB_OK;
+
+     if (!lock || !lock->handle)
+          return DFB_BUFFEREMPTY;
+
+     if (egl->readback_size < size) {
+          if (egl->readback)
+               D_FREE( egl->readback );
+
+          egl->readback_size = 0;
+
+          egl->readback = D_MALLOC( size );
+          if (!egl->readback)
+               return D_OOM();
+
+          egl->readback_size = size;
+     }
+
+     glGenFramebuffers( 1, &fbo );
+     glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+     glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, (GLuint)(long) lock->handle, 0 );
+
+     glReadPixels( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, egl->readback );
+
+     glBindFramebuffer( GL_FRAMEBUFFER, thread->bound_fbo );
+     glDeleteFramebuffers( 1, &fbo );
+
+     return egl_sink_write( egl->sink, egl->readback, width * 4, width, height, DRM_FORMAT_ABGR8888 );
+}
+
+/* Updates without a present leave the buffers as they are. */
+static DFBResult
+egl_primary_update( EGLData               *egl,
+                    CoreSurface           *surface,
+                    const DFBRegion       *update,
+                    CoreSurfaceBufferLock *lock,
+                    bool                  *ret_presented )
+{
+     DFBResult ret;
+     DFBRegion region = DFB_REGION_INIT_FROM_DIMENSION( &surface->config.size );
+
+     *ret_presented = false;
+
+     if (update && !dfb_region_region_intersect( &region, update ))
+          return DFB_OK;
+
+     /* Another DRM master owns the display, the layer is shown again on resume. */
+     if (egl->suspended) {
+          egl_delete_deferred( egl );
+          return DFB_OK;
+     }
+
+     if (egl->dumb) {
+          ret = egl_present_dumb( egl, surface, lock );
+
+          *ret_presented = true;
+
+          return ret;
+     }
+
+     egl_flush_requested( egl, egl_thread_data( egl ) );
+
+     egl_resize_pending( egl );
+
+     if (egl_is_unchanged( egl )) {
+          D_DEBUG_AT( EGL_Layer, "  -> unchanged\n" );
+
+          egl_delete_deferred( egl );
+
+          return DFB_OK;
+     }
+
+     egl_idle_lock( egl );
+
+     /* The display mode is restored with the next frame. */
+     if (egl->idle) {
+          egl->idle    = false;
+          egl->modeset = true;
+     }
+
+     egl->dirty       = false;
+     egl->last_change = direct_clock_get_abs_micros();
+
+     if (egl->headless)
+          ret = egl_present_headless( egl, surface, lock );
+     else if (egl->atomic)
+          ret = egl_present_atomic( egl, &region );
+     else
+          ret = egl_present_legacy( egl, &region );
+
+     egl_idle_unlock( egl );
+
+     /* Objects released during the frame are no longer used once it is submitted. */
+     egl_delete_deferred( egl );
+
+     *ret_presented = true;
+
+     return ret;
+}
+
 static DFBResult
 eglPrimaryUpdateRegion( CoreLayer             *layer,
                         void                  *driver_data,
@@ -142,49 +1010,385 @@ eglPrimaryUpdateRegion( CoreLayer             *layer,
                         const DFBRegion       *right_update,
                         CoreSurfaceBufferLock *right_lock )
 {
-     EGLData         *egl           = driver_data;
-     DFBRegion        region        = DFB_REGION_INIT_FROM_DIMENSION( &surface->config.size );
-     drmEventContext  event_context = { DRM_EVENT_CONTEXT_VERSION, NULL, NULL };
-     struct gbm_bo   *bo;
-     uint32_t         fb_id;
+     EGLData *egl = driver_data;
+     bool     presented;
 
      D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
 
      D_ASSERT( egl != NULL );
 
-     if (left_update && !dfb_region_region_intersect( &region, left_update ))
-          return DFB_OK;
+     return egl_primary_update( egl, surface, left_update, left_lock, &presented );
+}
 
-     eglSwapBuffers( egl->eglDisplay, egl->eglSurface );
+static DFBResult
+eglPrimaryFlipRegion( CoreLayer             *layer,
+                      void                  *driver_data,
+                      void                  *layer_data,
+                      void                  *region_data,
+                      CoreSurface           *surface,
+                      DFBSurfaceFlipFlags    flags,
+                      const DFBRegion       *left_update,
+                      CoreSurfaceBufferLock *left_lock,
+                      const DFBRegion       *right_update,
+                      CoreSurfaceBufferLock *right_lock )
+{
+     DFBResult  ret;
+     EGLData   *egl = driver_data;
+     bool       presented;
 
-     bo = gbm_surface_lock_front_buffer( egl->gbm_surface );
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
 
-     if (bo) {
-          fb_id = (uintptr_t) gbm_bo_get_user_data( bo );
+     D_ASSERT( egl != NULL );
 
-          if(!fb_id) {
-               drmModeAddFB( egl->fd, gbm_bo_get_width( bo ), gbm_bo_get_height( bo ), 24, 32, gbm_bo_get_stride( bo ),
-                             gbm_bo_get_handle( bo ).u32, &fb_id );
+     /*
+      * The locked back buffer is presented and becomes the front buffer. With EGL, both buffers render into the
+      * scanout surface, so the flip replaces a copy of the scanout surface onto itself. Without a present, the back
+      * buffer stays the one drawn to, the front buffer may still be on screen.
+      */
+     ret = egl_primary_update( egl, surface, left_update, left_lock, &presented );
+     if (ret || !presented)
+          return ret;
 
-               drmModeSetCrtc( egl->fd, egl->encoder->crtc_id, fb_id, 0, 0, &egl->connector->connector_id, 1,
-                               &egl->connector->modes[0] );
+     dfb_surface_flip_buffers( surface, false );
 
-               gbm_bo_set_user_data( bo, (void *)(uintptr_t) fb_id, egl_destroy_user_data );
-          }
+     return DFB_OK;
+}
 
-          drmModePageFlip( egl->fd, egl->encoder->crtc_id, fb_id, DRM_MODE_PAGE_FLIP_EVENT, NULL );
+static DFBResult
+eglPrimarySetColorAdjustment( CoreLayer          *layer,
+                              void               *driver_data,
+                              void               *layer_data,
+                              DFBColorAdjustment *adjustment )
+{
+     EGLData              *egl = driver_data;
+     struct drm_color_lut *lut;
+     struct drm_color_ctm  ctm;
+     uint64_t              lut_size;
+     uint32_t              gamma_blob, ctm_blob;
+     double                brightness = 0.0, contrast = 1.0, saturation = 1.0;
+     double                value;
+     const double          luma[3] = { 0.2126, 0.7152, 0.0722 };
+     drmModeAtomicReq     *req;
+     int                   i, j;
 
-          drmHandleEvent( egl->fd, &event_context );
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
 
-          gbm_surface_release_buffer( egl->gbm_surface, bo );
+     D_ASSERT( egl != NULL );
+
+     if (!egl_has_color_management( egl ) || !egl_kms_get_property( &egl->kms_crtc, "GAMMA_LUT_SIZE", &lut_size ) ||
+         !lut_size)
+          return DFB_UNSUPPORTED;
+
+     /* 0x8000 is neutral for all adjustments. */
+     if (adjustment->flags & DCAF_BRIGHTNESS)
+          brightness = (adjustment->brightness - 0x8000) / 65536.0;
+
+     if (adjustment->flags & DCAF_CONTRAST)
+          contrast = adjustment->contrast / 32768.0;
+
+     if (adjustment->flags & DCAF_SATURATION)
+          saturation = adjustment->saturation / 32768.0;
+
+     lut = D_CALLOC( lut_size, sizeof(struct drm_color_lut) );
+     if (!lut)
+          return D_OOM();
+
+     /* Brightness and contrast in the gamma lookup table. */
+     for (i = 0; i < lut_size; i++) {
+          value = (((double) i / (lut_size - 1) - 0.5) * contrast + 0.5) + brightness;
+          value = value < 0.0 ? 0.0 : value > 1.0 ? 1.0 : value;
+
+          lut[i].red = lut[i].green = lut[i].blue = value * 0xffff;
+     }
+
+     /* Saturation in the color transformation matrix, interpolating between luminance and identity. */
+     for (i = 0; i < 3; i++) {
+          for (j = 0; j < 3; j++)
+               ctm.matrix[i*3+j] = ctm_value( (1.0 - saturation) * luma[j] + (i == j ? saturation : 0.0) );
+     }
+
+     if (drmModeCreatePropertyBlob( egl->fd, lut, lut_size * sizeof(struct drm_color_lut), &gamma_blob )) {
+          D_FREE( lut );
+          return DFB_FAILURE;
+     }
+
+     D_FREE( lut );
+
+     if (drmModeCreatePropertyBlob( egl->fd, &ctm, sizeof(ctm), &ctm_blob )) {
+          drmModeDestroyPropertyBlob( egl->fd, gamma_blob );
+          return DFB_FAILURE;
+     }
+
+     if (egl->gamma_blob)
+          drmModeDestroyPropertyBlob( egl->fd, egl->gamma_blob );
+
+     if (egl->ctm_blob)
+          drmModeDestroyPropertyBlob( egl->fd, egl->ctm_blob );
+
+     egl->gamma_blob    = gamma_blob;
+     egl->ctm_blob      = ctm_blob;
+     egl->color_pending = true;
+
+     egl_idle_lock( egl );
+
+     /* Before the first mode set or while suspended, the adjustment is committed with the next one. */
+     if (egl->modeset || egl->suspended) {
+          egl_idle_unlock( egl );
+          return DFB_OK;
+     }
+
+     egl_wait_out_fence( egl );
+
+     req = drmModeAtomicAlloc();
+
+     egl_add_color_properties( egl, req );
+
+     if (drmModeAtomicCommit( egl->fd, req, 0, NULL )) {
+          D_PERROR( "EGL/Layer: drmModeAtomicCommit() failed!\n" );
+          egl->color_pending = true;
      }
 
+     drmModeAtomicFree( req );
+
+     egl_idle_unlock( egl );
+
      return DFB_OK;
 }
 
 const DisplayLayerFuncs eglPrimaryLayerFuncs = {
-     .InitLayer    = eglPrimaryInitLayer,
-     .TestRegion   = eglPrimaryTestRegion,
-     .SetRegion    = eglPrimarySetRegion,
-     .UpdateRegion = eglPrimaryUpdateRegion
+     .InitLayer          = eglPrimaryInitLayer,
+     .TestRegion         = eglPrimaryTestRegion,
+     .SetRegion          = eglPrimarySetRegion,
+     .UpdateRegion       = eglPrimaryUpdateRegion,
+     .FlipRegion         = eglPrimaryFlipRegion,
+     .SetColorAdjustment = eglPrimarySetColorAdjustment
+};
+
+/**********************************************************************************************************************/
+
+static void
+egl_cursor_move( EGLData *egl,
+                 int      x,
+                 int      y )
+{
+     /* Layer coordinates are scaled to the display mode by the primary plane. */
+     if (egl->scanout.w && egl->scanout.h) {
+          x = x * egl->mode_info.hdisplay / egl->scanout.w;
+          y = y * egl->mode_info.vdisplay / egl->scanout.h;
+     }
+
+     egl->cursor_position.x = x;
+     egl->cursor_position.y = y;
+
+     /* While suspended, the position is applied on resume. */
+     if (!egl->suspended)
+          drmModeMoveCursor( egl->fd, egl->crtc->crtc_id, x, y );
+}
+
+static DFBResult
+egl_cursor_upload( EGLData               *egl,
+                   CoreSurface           *surface,
+                   CoreSurfaceBufferLock *lock )
+{
+     EGLThreadData *thread = egl_thread_data( egl );
+     int            width  = MIN( surface->config.size.w, egl->cursor_size.w );
+     int            height = MIN( surface->config.size.h, egl->cursor_size.h );
+     u8            *pixels;
+     u32           *image;
+     GLuint         fbo;
+     int            x, y;
+
+     D_DEBUG_AT( EGL_Layer, "%s( %dx%d )\n", __FUNCTION__, width, height );
+
+     if (!lock || !lock->handle)
+          return DFB_BUFFEREMPTY;
+
+     pixels = D_MALLOC( width * height * 4 );
+     image  = D_CALLOC( egl->cursor_size.w * egl->cursor_size.h, 4 );
+     if (!pixels || !image) {
+          if (pixels)
+               D_FREE( pixels );
+
+          if (image)
+               D_FREE( image );
+
+          return D_OOM();
+     }
+
+     /* Read back the cursor shape, this is only done when it changes. */
+     glGenFramebuffers( 1, &fbo );
+     glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+     glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, (GLuint)(long) lock->handle, 0 );
+
+     glReadPixels( 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+
+     glBindFramebuffer( GL_FRAMEBUFFER, thread->bound_fbo );
+     glDeleteFramebuffers( 1, &fbo );
+
+     for (y = 0; y < height; y++) {
+          const u8 *src = pixels + y * width * 4;
+          u32      *dst = image + y * egl->cursor_size.w;
+
+          for (x = 0; x < width; x++, src += 4)
+               dst[x] = (src[3] << 24) | (src[0] << 16) | (src[1] << 8) | src[2];
+     }
+
+     gbm_bo_write( egl->cursor_bo, image, egl->cursor_size.w * egl->cursor_size.h * 4 );
+
+     D_FREE( image );
+     D_FREE( pixels );
+
+     if (!egl->suspended && egl_cursor_show( egl ))
+          return DFB_FAILURE;
+
+     egl->cursor_visible = true;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglCursorInitLayer( CoreLayer                  *layer,
+                    void                       *driver_data,
+                    void                       *layer_data,
+                    DFBDisplayLayerDescription *description,
+                    DFBDisplayLayerConfig      *config,
+                    DFBColorAdjustment         *adjustment )
+{
+     EGLData *egl = driver_data;
+
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
+
+     D_ASSERT( egl != NULL );
+
+     /* Set type and capabilities. */
+     description->caps = DLCAPS_SURFACE | DLCAPS_SCREEN_POSITION | DLCAPS_ALPHACHANNEL;
+     description->type = DLTF_GRAPHICS;
+
+     /* Set name. */
+     snprintf( description->name, DFB_DISPLAY_LAYER_DESC_NAME_LENGTH, "EGL Cursor Layer" );
+
+     /* Fill out the default configuration. */
+     config->flags       = DLCONF_WIDTH | DLCONF_HEIGHT | DLCONF_PIXELFORMAT | DLCONF_BUFFERMODE | DLCONF_OPTIONS;
+     config->width       = egl->cursor_size.w;
+     config->height      = egl->cursor_size.h;
+     config->pixelformat = DSPF_ARGB;
+     config->buffermode  = DLBM_FRONTONLY;
+     config->options     = DLOP_ALPHACHANNEL;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglCursorTestRegion( CoreLayer                  *layer,
+                     void                       *driver_data,
+                     void                       *layer_data,
+                     CoreLayerRegionConfig      *config,
+                     CoreLayerRegionConfigFlags *ret_failed )
+{
+     EGLData                    *egl    = driver_data;
+     CoreLayerRegionConfigFlags  failed = CLRCF_NONE;
+
+     D_DEBUG_AT( EGL_Layer, "%s( %dx%d, %s )\n", __FUNCTION__,
+                 config->source.w, config->source.h, dfb_pixelformat_name( config->format ) );
+
+     if (config->width > egl->cursor_size.w)
+          failed |= CLRCF_WIDTH;
+
+     if (config->height > egl->cursor_size.h)
+          failed |= CLRCF_HEIGHT;
+
+     if (config->format != DSPF_ARGB)
+          failed |= CLRCF_FORMAT;
+
+     if (config->buffermode != DLBM_FRONTONLY)
+          failed |= CLRCF_BUFFERMODE;
+
+     if (config->options & ~DLOP_ALPHACHANNEL)
+          failed |= CLRCF_OPTIONS;
+
+     if (ret_failed)
+          *ret_failed = failed;
+
+     if (failed)
+          return DFB_UNSUPPORTED;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglCursorSetRegion( CoreLayer                  *layer,
+                    void                       *driver_data,
+                    void                       *layer_data,
+                    void                       *region_data,
+                    CoreLayerRegionConfig      *config,
+                    CoreLayerRegionConfigFlags  updated,
+                    CoreSurface                *surface,
+                    CorePalette                *palette,
+                    CoreSurfaceBufferLock      *left_lock,
+                    CoreSurfaceBufferLock      *right_lock )
+{
+     EGLData   *egl = driver_data;
+     DFBResult  ret = DFB_OK;
+
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
+
+     D_ASSERT( egl != NULL );
+
+     /* Moving the cursor is a single ioctl, no rendering and no page flip. */
+     if (updated & CLRCF_DEST)
+          egl_cursor_move( egl, config->dest.x, config->dest.y );
+
+     if (updated & CLRCF_SURFACE)
+          ret = egl_cursor_upload( egl, surface, left_lock );
+
+     return ret;
+}
+
+static DFBResult
+eglCursorRemoveRegion( CoreLayer *layer,
+                       void      *driver_data,
+                       void      *layer_data,
+                       void      *region_data )
+{
+     EGLData *egl = driver_data;
+
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
+
+     D_ASSERT( egl != NULL );
+
+     if (!egl->suspended)
+          drmModeSetCursor( egl->fd, egl->crtc->crtc_id, 0, 0, 0 );
+
+     egl->cursor_visible = false;
+
+     return DFB_OK;
+}
+
+static DFBResult
+eglCursorUpdateRegion( CoreLayer             *layer,
+                       void                  *driver_data,
+                       void                  *layer_data,
+                       void                  *region_data,
+                       CoreSurface           *surface,
+                       const DFBRegion       *left_update,
+                       CoreSurfaceBufferLock *left_lock,
+                       const DFBRegion       *right_update,
+                       CoreSurfaceBufferLock *right_lock )
+{
+     EGLData *egl = driver_data;
+
+     D_DEBUG_AT( EGL_Layer, "%s()\n", __FUNCTION__ );
+
+     D_ASSERT( egl != NULL );
+
+     /* The shape changed. */
+     return egl_cursor_upload( egl, surface, left_lock );
+}
+
+const DisplayLayerFuncs eglCursorLayerFuncs = {
+     .InitLayer    = eglCursorInitLayer,
+     .TestRegion   = eglCursorTestRegion,
+     .SetRegion    = eglCursorSetRegion,
+     .RemoveRegion = eglCursorRemoveRegion,
+     .UpdateRegion = eglCursorUpdateRegion
 };
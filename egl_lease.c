@@ -0,0 +1,367 @@
+/*
+   This file is part of DirectFB.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include <direct/thread.h>
+#include <direct/util.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "egl_system.h"
+
+D_DEBUG_DOMAIN( EGL_Lease, "EGL/Lease", "EGL Lease" );
+
+/**********************************************************************************************************************/
+
+struct _EGLLease {
+     int           listen_fd;
+     int           client_fd;      /* connected lessee or -1 */
+     int           wakeup_fd;      /* eventfd stopping the thread */
+     char          path[108];
+
+     DirectThread *thread;
+
+     uint32_t      objects[3];     /* connector, CRTC and plane */
+     bool          shared;         /* connector and CRTC used for the display as well */
+
+     uint32_t      lessee_id;      /* current lease or 0 */
+};
+
+/**********************************************************************************************************************/
+
+static DFBResult
+find_connector_objects( EGLData    *egl,
+                        const char *name,
+                        uint32_t    objects[3] )
+{
+     drmModeConnector *connector;
+     drmModeEncoder   *encoder;
+     char              buf[32];
+     uint32_t          plane_id;
+     int               i, j, k;
+
+     /* A connected connector other than the display one, with a CRTC other than the display one. */
+     for (i = 0; i < egl->resources->count_connectors; i++) {
+          connector = drmModeGetConnector( egl->fd, egl->resources->connectors[i] );
+          if (!connector)
+               continue;
+
+          egl_kms_connector_name( connector, buf, sizeof(buf) );
+
+          if (connector->connection == DRM_MODE_CONNECTED && !strcasecmp( buf, name ) &&
+              connector->connector_id != egl->connector->connector_id) {
+               for (j = 0; j < connector->count_encoders; j++) {
+                    encoder = drmModeGetEncoder( egl->fd, connector->encoders[j] );
+                    if (!encoder)
+                         continue;
+
+                    for (k = 0; k < egl->resources->count_crtcs; k++) {
+                         if (!(encoder->possible_crtcs & (1 << k)) || egl->resources->crtcs[k] == egl->crtc->crtc_id)
+                              continue;
+
+                         plane_id = egl_kms_find_plane( egl, k, DRM_PLANE_TYPE_PRIMARY );
+                         if (plane_id) {
+                              objects[0] = connector->connector_id;
+                              objects[1] = egl->resources->crtcs[k];
+                              objects[2] = plane_id;
+
+                              drmModeFreeEncoder( encoder );
+                              drmModeFreeConnector( connector );
+
+                              return DFB_OK;
+                         }
+                    }
+
+                    drmModeFreeEncoder( encoder );
+               }
+          }
+
+          drmModeFreeConnector( connector );
+     }
+
+     return DFB_ITEMNOTFOUND;
+}
+
+static void
+egl_lease_revoke( EGLData *egl )
+{
+     EGLLease *lease = egl->lease;
+
+     if (lease->lessee_id) {
+          D_INFO( "EGL/Lease: Revoking lease %u\n", lease->lessee_id );
+
+          if (drmModeRevokeLease( egl->fd, lease->lessee_id ))
+               D_PERROR( "EGL/Lease: drmModeRevokeLease() failed!\n" );
+
+          lease->lessee_id = 0;
+     }
+
+     if (lease->client_fd != -1) {
+          close( lease->client_fd );
+
+          lease->client_fd = -1;
+     }
+}
+
+static void
+egl_lease_accept( EGLData *egl )
+{
+     EGLLease       *lease = egl->lease;
+     EGLLeaseInfo    info;
+     struct ucred    cred;
+     socklen_t       len   = sizeof(cred);
+     int             fd;
+     char            control[CMSG_SPACE(sizeof(int))];
+     struct iovec    iov   = { &info, sizeof(info) };
+     struct msghdr   msg;
+     struct cmsghdr *cmsg;
+
+     fd = accept4( lease->listen_fd, NULL, NULL, SOCK_CLOEXEC );
+     if (fd == -1)
+          return;
+
+     /* One lessee at a time. */
+     if (lease->client_fd != -1) {
+          D_INFO( "EGL/Lease: Objects already leased, rejecting client\n" );
+          close( fd );
+          return;
+     }
+
+     /* Only processes of the same user or of root are authorized. */
+     if (getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &cred, &len ) || (cred.uid && cred.uid != geteuid())) {
+          D_ERROR( "EGL/Lease: Client is not authorized!\n" );
+          close( fd );
+          return;
+     }
+
+     lease->client_fd = fd;
+
+     fd = drmModeCreateLease( egl->fd, lease->objects, D_ARRAY_SIZE(lease->objects), O_CLOEXEC, &lease->lessee_id );
+     if (fd < 0) {
+          D_PERROR( "EGL/Lease: drmModeCreateLease() failed!\n" );
+          lease->lessee_id = 0;
+          egl_lease_revoke( egl );
+          return;
+     }
+
+     memset( &info, 0, sizeof(info) );
+
+     info.magic        = EGL_LEASE_MAGIC;
+     info.lessee_id    = lease->lessee_id;
+     info.connector_id = lease->objects[0];
+     info.crtc_id      = lease->objects[1];
+     info.plane_id     = lease->objects[2];
+     info.shared       = lease->shared;
+
+     memset( &msg, 0, sizeof(msg) );
+     msg.msg_iov        = &iov;
+     msg.msg_iovlen     = 1;
+     msg.msg_control    = control;
+     msg.msg_controllen = sizeof(control);
+
+     cmsg = CMSG_FIRSTHDR( &msg );
+     cmsg->cmsg_level = SOL_SOCKET;
+     cmsg->cmsg_type  = SCM_RIGHTS;
+     cmsg->cmsg_len   = CMSG_LEN(sizeof(int));
+     memcpy( CMSG_DATA(cmsg), &fd, sizeof(int) );
+
+     if (sendmsg( lease->client_fd, &msg, MSG_NOSIGNAL ) < 0) {
+          D_PERROR( "EGL/Lease: sendmsg() failed!\n" );
+          egl_lease_revoke( egl );
+     }
+     else
+          D_INFO( "EGL/Lease: Lease %u granted to pid %d\n", lease->lessee_id, cred.pid );
+
+     /* The lessee has its own reference. */
+     close( fd );
+}
+
+static void *
+egl_lease_loop( DirectThread *thread,
+                void         *arg )
+{
+     EGLData       *egl   = arg;
+     EGLLease      *lease = egl->lease;
+     struct pollfd  pfd[3];
+     char           buf[64];
+     ssize_t        len;
+
+     D_DEBUG_AT( EGL_Lease, "%s()\n", __FUNCTION__ );
+
+     while (true) {
+          pfd[0].fd     = lease->wakeup_fd;
+          pfd[0].events = POLLIN;
+          pfd[1].fd     = lease->listen_fd;
+          pfd[1].events = POLLIN;
+          pfd[2].fd     = lease->client_fd;
+          pfd[2].events = POLLIN;
+
+          if (poll( pfd, D_ARRAY_SIZE(pfd), -1 ) < 0) {
+               if (errno == EINTR)
+                    continue;
+
+               D_PERROR( "EGL/Lease: poll() failed!\n" );
+               break;
+          }
+
+          if (pfd[0].revents)
+               break;
+
+          /* Messages of the lessee are ignored, the lease ends with the connection. */
+          if (pfd[2].revents) {
+               len = recv( lease->client_fd, buf, sizeof(buf), MSG_DONTWAIT );
+
+               if (len == 0 || (len < 0 && errno != EAGAIN && errno != EINTR)) {
+                    D_INFO( "EGL/Lease: Lessee disconnected\n" );
+
+                    egl_lease_revoke( egl );
+               }
+          }
+
+          if (pfd[1].revents & POLLIN)
+               egl_lease_accept( egl );
+     }
+
+     return NULL;
+}
+
+/**********************************************************************************************************************/
+
+DFBResult
+egl_lease_init( EGLData    *egl,
+                const char *path,
+                const char *connector )
+{
+     DFBResult           ret;
+     EGLLease           *lease;
+     struct sockaddr_un  addr;
+
+     D_DEBUG_AT( EGL_Lease, "%s( '%s', '%s' )\n", __FUNCTION__, path, connector ?: "" );
+
+     lease = D_CALLOC( 1, sizeof(EGLLease) );
+     if (!lease)
+          return D_OOM();
+
+     lease->listen_fd = -1;
+     lease->client_fd = -1;
+     lease->wakeup_fd = -1;
+
+     egl->lease = lease;
+
+     /* A lease always contains a connector and a CRTC, a plane alone is leased with the display ones. */
+     if (connector) {
+          ret = find_connector_objects( egl, connector, lease->objects );
+          if (ret) {
+               D_ERROR( "EGL/Lease: No free CRTC for connector %s!\n", connector );
+               goto error;
+          }
+     }
+     else {
+          lease->objects[0] = egl->connector->connector_id;
+          lease->objects[1] = egl->crtc->crtc_id;
+          lease->objects[2] = egl_kms_find_plane( egl, egl->crtc_index, DRM_PLANE_TYPE_OVERLAY );
+          lease->shared     = true;
+
+          if (!lease->objects[2]) {
+               D_INFO( "EGL/Lease: No overlay plane for the CRTC\n" );
+               ret = DFB_UNSUPPORTED;
+               goto error;
+          }
+     }
+
+     lease->wakeup_fd = eventfd( 0, EFD_CLOEXEC );
+     if (lease->wakeup_fd < 0) {
+          D_PERROR( "EGL/Lease: eventfd() failed!\n" );
+          ret = DFB_IO;
+          goto error;
+     }
+
+     lease->listen_fd = socket( AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0 );
+     if (lease->listen_fd < 0) {
+          D_PERROR( "EGL/Lease: socket() failed!\n" );
+          ret = DFB_IO;
+          goto error;
+     }
+
+     memset( &addr, 0, sizeof(addr) );
+     addr.sun_family = AF_UNIX;
+     direct_snputs( addr.sun_path, path, sizeof(addr.sun_path) );
+     direct_snputs( lease->path, path, sizeof(lease->path) );
+
+     unlink( lease->path );
+
+     if (bind( lease->listen_fd, (struct sockaddr*) &addr, sizeof(addr) ) || listen( lease->listen_fd, 1 )) {
+          D_PERROR( "EGL/Lease: Failed to listen on '%s'!\n", path );
+          lease->path[0] = 0;
+          ret = DFB_IO;
+          goto error;
+     }
+
+     lease->thread = direct_thread_create( DTT_DEFAULT, egl_lease_loop, egl, "EGL Lease" );
+     if (!lease->thread) {
+          ret = DFB_INIT;
+          goto error;
+     }
+
+     D_INFO( "EGL/Lease: Leasing connector %u, CRTC %u and plane %u on %s\n",
+             lease->objects[0], lease->objects[1], lease->objects[2], path );
+
+     return DFB_OK;
+
+error:
+     egl_lease_deinit( egl );
+
+     return ret;
+}
+
+void
+egl_lease_deinit( EGLData *egl )
+{
+     EGLLease *lease = egl->lease;
+     uint64_t  value = 1;
+
+     D_DEBUG_AT( EGL_Lease, "%s()\n", __FUNCTION__ );
+
+     if (lease->thread) {
+          if (write( lease->wakeup_fd, &value, sizeof(value) ) != sizeof(value))
+               D_PERROR( "EGL/Lease: write() failed!\n" );
+
+          direct_thread_join( lease->thread );
+          direct_thread_destroy( lease->thread );
+     }
+
+     egl_lease_revoke( egl );
+
+     if (lease->listen_fd != -1)
+          close( lease->listen_fd );
+
+     if (lease->wakeup_fd != -1)
+          close( lease->wakeup_fd );
+
+     if (lease->path[0])
+          unlink( lease->path );
+
+     D_FREE( lease );
+
+     egl->lease = NULL;
+}
@@ -86,7 +86,7 @@ eglInitScreen( CoreScreen           *screen,
      if (dfb_config->layers[dfb_config->primary_layer].rotate_set) {
           data->rotation = dfb_config->layers[dfb_config->primary_layer].rotate;
      }
-     else {
+     else if (egl->connector) {
           drmModeObjectProperties *props;
           drmModePropertyRes      *prop;
           int                      i;
@@ -94,36 +94,75 @@ eglInitScreen( CoreScreen           *screen,
           data->rotation = 0;
 
           props = drmModeObjectGetProperties( egl->fd, egl->connector->connector_id, DRM_MODE_OBJECT_CONNECTOR );
-          if (!props)
-               return DFB_OK;
-
-          for (i = 0; i < props->count_props; i++) {
-               prop = drmModeGetProperty( egl->fd, props->props[i] );
+          if (props) {
+               for (i = 0; i < props->count_props; i++) {
+                    prop = drmModeGetProperty( egl->fd, props->props[i] );
+                    if (!prop)
+                         continue;
 
-               if (!strcmp( prop->name, "panel orientation" )) {
-                    D_ASSUME( props->prop_values[i] >= 0 && props->prop_values[i] <= 3 );
+                    if (!strcmp( prop->name, "panel orientation" )) {
+                         D_ASSUME( props->prop_values[i] >= 0 && props->prop_values[i] <= 3 );
 
-                    for (i = 0; i < prop->count_enums; i++) {
                          if (!strcmp( panel_orientation_table[props->prop_values[i]], "Upside Down" ))
                               data->rotation = 180;
                          else if (!strcmp( panel_orientation_table[props->prop_values[i]], "Left Side Up" ))
                               data->rotation = 270;
                          else if (!strcmp( panel_orientation_table[props->prop_values[i]], "Right Side Up" ))
                               data->rotation = 90;
+
+                         D_INFO( "EGL/Screen: Using %s panel orientation (rotation = %d)\n",
+                                 panel_orientation_table[props->prop_values[i]], data->rotation );
+
+                         drmModeFreeProperty( prop );
+                         break;
                     }
 
-                    D_INFO( "EGL/Screen: Using %s panel orientation (rotation = %d)\n",
-                            panel_orientation_table[props->prop_values[i]], data->rotation );
-                    break;
+                    drmModeFreeProperty( prop );
                }
 
-               drmModeFreeProperty( prop );
+               drmModeFreeObjectProperties( props );
+          }
+     }
+
+     /* Let the primary plane rotate unrotated buffers if it supports the rotation. */
+     if (data->rotation && !direct_config_has_name( "eglgbm-no-plane-rotation" )) {
+          uint64_t plane_rotation;
+
+          switch (data->rotation) {
+               case 90:
+                    plane_rotation = DRM_MODE_ROTATE_90;
+                    break;
+               case 180:
+                    plane_rotation = DRM_MODE_ROTATE_180;
+                    break;
+               case 270:
+                    plane_rotation = DRM_MODE_ROTATE_270;
+                    break;
+               default:
+                    plane_rotation = 0;
+                    break;
           }
 
-          drmModeFreeObjectProperties( props );
+          if (plane_rotation && (egl->rotations & plane_rotation)) {
+               egl->plane_rotation = plane_rotation;
+
+               D_INFO( "EGL/Screen: Using plane rotation (rotation = %d)\n", data->rotation );
+          }
      }
 
-     if (data->rotation == 90 || data->rotation == 270) {
+     if (egl->plane_rotation) {
+          if (data->rotation == 90 || data->rotation == 270) {
+               shared->mode.w = height;
+               shared->mode.h = width;
+          }
+          else {
+               shared->mode.w = width;
+               shared->mode.h = height;
+          }
+
+          data->rotation = 0;
+     }
+     else if (data->rotation == 90 || data->rotation == 270) {
           shared->mode.w = height <= width ? width : (float) height * height / width;
           shared->mode.h = height <= width ? (float) width * width / height : height;
      }
@@ -132,6 +171,27 @@ eglInitScreen( CoreScreen           *screen,
           shared->mode.h = height;
      }
 
+     /* Render at the configured size, the primary plane scales the scanout surface to the display mode. */
+     if (egl->atomic && !data->rotation) {
+          if (shared->mode.w == egl->mode_info.hdisplay && shared->mode.h == egl->mode_info.vdisplay) {
+               egl->plane_scaling = true;
+          }
+          else if (egl_test_scaling( egl, shared->mode.w, shared->mode.h )) {
+               egl->plane_scaling = true;
+
+               D_INFO( "EGL/Screen: Scaling %dx%d to %dx%d\n",
+                       shared->mode.w, shared->mode.h, egl->mode_info.hdisplay, egl->mode_info.vdisplay );
+          }
+          else
+               D_INFO( "EGL/Screen: Primary plane can not scale %dx%d to %dx%d, using the display size\n",
+                       shared->mode.w, shared->mode.h, egl->mode_info.hdisplay, egl->mode_info.vdisplay );
+
+          if (egl->plane_scaling && (shared->mode.w != egl->scanout.w || shared->mode.h != egl->scanout.h)) {
+               if (egl_resize_scanout( egl, shared->mode.w, shared->mode.h, egl->format ))
+                    return DFB_INIT;
+          }
+     }
+
      return DFB_OK;
 }
 
@@ -0,0 +1,231 @@
+/*
+   This file is part of DirectFB.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include <direct/memcpy.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "egl_system.h"
+
+D_DEBUG_DOMAIN( EGL_Sink, "EGL/Sink", "EGL Sink" );
+
+/**********************************************************************************************************************/
+
+typedef enum {
+     EGL_SINK_FILE,                /* frames appended to a regular file */
+     EGL_SINK_PIPE,                /* frames written to a FIFO or a pipe */
+     EGL_SINK_SHM                  /* ring of frames in shared memory */
+} EGLSinkType;
+
+struct _EGLSink {
+     EGLSinkType    type;
+
+     int            fd;
+
+     EGLSinkHeader *header;        /* mapping of the shared memory ring */
+     size_t         length;
+     int            slots;
+};
+
+#define EGL_SINK_SLOTS 3
+
+/**********************************************************************************************************************/
+
+static DFBResult
+egl_sink_map( EGLSink  *sink,
+              int       width,
+              int       height,
+              uint32_t  format )
+{
+     size_t length = sizeof(EGLSinkHeader) + (size_t) width * 4 * height * sink->slots;
+
+     D_DEBUG_AT( EGL_Sink, "%s( %dx%d )\n", __FUNCTION__, width, height );
+
+     if (sink->header)
+          munmap( sink->header, sink->length );
+
+     sink->header = NULL;
+
+     if (ftruncate( sink->fd, length )) {
+          D_PERROR( "EGL/Sink: ftruncate() failed!\n" );
+          return DFB_IO;
+     }
+
+     sink->header = mmap( NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, sink->fd, 0 );
+     if (sink->header == MAP_FAILED) {
+          D_PERROR( "EGL/Sink: mmap() failed!\n" );
+          sink->header = NULL;
+          return DFB_IO;
+     }
+
+     sink->length = length;
+
+     sink->header->magic    = EGL_SINK_MAGIC;
+     sink->header->format   = format;
+     sink->header->width    = width;
+     sink->header->height   = height;
+     sink->header->pitch    = width * 4;
+     sink->header->slots    = sink->slots;
+     sink->header->sequence = 0;
+
+     return DFB_OK;
+}
+
+static DFBResult
+egl_sink_write_fd( EGLSink    *sink,
+                   const void *pixels,
+                   size_t      length )
+{
+     const u8 *data = pixels;
+
+     while (length) {
+          ssize_t written = write( sink->fd, data, length );
+
+          if (written < 0) {
+               if (errno == EINTR)
+                    continue;
+
+               D_PERROR( "EGL/Sink: write() failed!\n" );
+               return DFB_IO;
+          }
+
+          data   += written;
+          length -= written;
+     }
+
+     return DFB_OK;
+}
+
+/**********************************************************************************************************************/
+
+DFBResult
+egl_sink_open( const char  *spec,
+               EGLSink    **ret_sink )
+{
+     EGLSink *sink;
+     char     path[256];
+
+     D_DEBUG_AT( EGL_Sink, "%s( '%s' )\n", __FUNCTION__, spec );
+
+     sink = D_CALLOC( 1, sizeof(EGLSink) );
+     if (!sink)
+          return D_OOM();
+
+     sink->slots = EGL_SINK_SLOTS;
+
+     if (!strncmp( spec, "file:", 5 )) {
+          sink->type = EGL_SINK_FILE;
+          sink->fd   = open( spec + 5, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+     }
+     else if (!strncmp( spec, "pipe:", 5 )) {
+          /* Opening a FIFO blocks until a reader is connected. */
+          sink->type = EGL_SINK_PIPE;
+          sink->fd   = spec[5] ? open( spec + 5, O_WRONLY | O_CLOEXEC ) : dup( STDOUT_FILENO );
+     }
+     else if (!strncmp( spec, "shm:", 4 )) {
+          sink->type = EGL_SINK_SHM;
+
+          snprintf( path, sizeof(path), "/dev/shm/%s", spec + 4 );
+
+          sink->fd = open( path, O_RDWR | O_CREAT | O_CLOEXEC, 0660 );
+     }
+     else {
+          D_ERROR( "EGL/Sink: Unknown sink '%s'!\n", spec );
+          D_FREE( sink );
+          return DFB_INVARG;
+     }
+
+     if (sink->fd < 0) {
+          D_PERROR( "EGL/Sink: Failed to open '%s'!\n", spec );
+          D_FREE( sink );
+          return DFB_IO;
+     }
+
+     D_INFO( "EGL/Sink: Delivering frames to %s\n", spec );
+
+     *ret_sink = sink;
+
+     return DFB_OK;
+}
+
+DFBResult
+egl_sink_write( EGLSink    *sink,
+                const void *pixels,
+                int         pitch,
+                int         width,
+                int         height,
+                uint32_t    format )
+{
+     DFBResult  ret;
+     const u8  *src = pixels;
+     u8        *slot;
+     uint64_t   sequence;
+     int        y;
+
+     D_ASSERT( sink != NULL );
+
+     if (sink->type != EGL_SINK_SHM) {
+          if (pitch == width * 4)
+               return egl_sink_write_fd( sink, pixels, (size_t) pitch * height );
+
+          for (y = 0; y < height; y++, src += pitch) {
+               ret = egl_sink_write_fd( sink, src, width * 4 );
+               if (ret)
+                    return ret;
+          }
+
+          return DFB_OK;
+     }
+
+     /* Readers notice the new size or format in the header. */
+     if (!sink->header || sink->header->width != width || sink->header->height != height ||
+         sink->header->format != format) {
+          ret = egl_sink_map( sink, width, height, format );
+          if (ret)
+               return ret;
+     }
+
+     sequence = sink->header->sequence;
+
+     slot = (u8*) (sink->header + 1) + (size_t) (sequence % sink->slots) * sink->header->pitch * height;
+
+     if (pitch == sink->header->pitch)
+          direct_memcpy( slot, pixels, (size_t) pitch * height );
+     else
+          for (y = 0; y < height; y++, src += pitch, slot += sink->header->pitch)
+               direct_memcpy( slot, src, width * 4 );
+
+     __atomic_store_n( &sink->header->sequence, sequence + 1, __ATOMIC_RELEASE );
+
+     return DFB_OK;
+}
+
+void
+egl_sink_close( EGLSink *sink )
+{
+     D_ASSERT( sink != NULL );
+
+     if (sink->header)
+          munmap( sink->header, sink->length );
+
+     close( sink->fd );
+
+     D_FREE( sink );
+}
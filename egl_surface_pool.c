@@ -16,6 +16,7 @@
    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
 */
 
+#include <direct/memcpy.h>
 #include <core/surface_allocation.h>
 #include <core/surface_buffer.h>
 #include <core/surface_pool.h>
@@ -24,23 +25,1289 @@
 
 #include "egl_system.h"
 
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2      0x9274
+#endif
+
+#ifndef GL_COMPRESSED_RGBA8_ETC2_EAC
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#endif
+
 D_DEBUG_DOMAIN( EGL_Surfaces, "EGL/Surfaces", "EGL Surface Pool" );
 D_DEBUG_DOMAIN( EGL_SurfLock, "EGL/SurfLock", "EGL Surface Pool Locks" );
 
-/**********************************************************************************************************************/
+/**********************************************************************************************************************/
+
+typedef enum {
+     EGL_ALLOC_LAYER,
+     EGL_ALLOC_WINDOW,
+     EGL_ALLOC_CURSOR,
+     EGL_ALLOC_FONT,
+     EGL_ALLOC_OTHER,
+     EGL_ALLOC_NUM
+} EGLAllocType;
+
+typedef struct {
+     EGLData         *egl;
+
+     /* Asynchronous uploads. */
+     DirectThread    *upload_thread;
+     DirectMutex      upload_lock;
+     DirectWaitQueue  upload_cond;
+     DirectLink      *upload_jobs;      /* pending jobs, in order of their staging ring space */
+     bool             upload_stop;
+
+     u8              *ring;             /* staging ring, reused by all uploads */
+     unsigned int     ring_size;
+     unsigned int     ring_head;        /* next free byte */
+     unsigned int     ring_tail;        /* first byte in use */
+
+     /* Video memory accounting. */
+     DirectMutex      lru_lock;
+     DirectLink      *lru;              /* resident allocations, least recently locked first */
+     unsigned long    used;             /* bytes of texture storage */
+     unsigned long    used_by_type[EGL_ALLOC_NUM];
+     unsigned long    budget;           /* eglgbm-videoram, 0 for no limit */
+     DirectWaitQueue  evict_cond;       /* used with lru_lock */
+
+     /* Compression of idle surfaces. */
+     DirectThread    *compress_thread;
+     DirectWaitQueue  compress_cond;    /* used with lru_lock */
+     bool             compress_stop;
+     long long        compress_idle;    /* time without writes before compression (micro seconds) */
+} EGLPoolLocalData;
+
+typedef struct {
+     DirectLink   link;         /* in the LRU list while the texture storage exists */
+
+     int          magic;
+
+     int          pitch;
+     int          size;
+
+     int          width;
+     int          height;
+
+     GLuint       tex;          /* texture, created with its storage on first write or lock */
+     GLuint       fbo;          /* framebuffer object, created on first GPU write lock */
+     EGLContext   fbo_context;  /* context owning the framebuffer object */
+
+     EGLSyncKHR   sync;         /* fence signaled when the last GPU access of this allocation completed */
+     EGLContext   sync_context; /* context in which the fence was inserted */
+     bool         sync_flushed; /* fence flushed when inserted */
+
+     int          uploads;      /* pending asynchronous uploads */
+
+     EGLAllocType type;
+     int          locks;        /* accesses in progress, which prevent eviction and compression */
+     u8          *evicted;      /* texture contents while evicted to system memory */
+
+     bool         alpha;        /* surface format with alpha channel */
+     long long    written;      /* time of the last write */
+     bool         compressing;  /* being compressed by the compression thread */
+     bool         evicting;     /* being evicted, without lru_lock held */
+     u8          *blocks;       /* ETC2 data of the compressed texture */
+     size_t       blocks_size;
+} EGLAllocationData;
+
+typedef struct {
+     DirectLink         link;
+
+     EGLAllocationData *alloc;
+     DFBRectangle       rect;
+
+     unsigned int       offset;       /* data in the staging ring */
+     unsigned int       length;
+
+     bool               ready;        /* data copied into the staging ring */
+} EGLUploadJob;
+
+/**********************************************************************************************************************/
+
+/*
+ * Bindings are tracked in a per-thread shadow instead of being queried with glGetIntegerv(), which is a synchronous
+ * round-trip on many drivers. Framebuffer bindings are only changed by the pool. Texture bindings are also changed by
+ * the graphics driver, which only binds textures it has locked for reading, so the texture shadow is marked unknown
+ * on these locks and queried at most once afterwards.
+ *
+ * A deleted texture stays bound in the other contexts, and its name can be reused for a new texture. The texture
+ * shadow records the generation of texture deletions it was set in, and does not match after further deletions.
+ */
+
+#define EGL_BINDING_UNKNOWN ((GLuint) -1)
+
+static inline void
+egl_bind_framebuffer( EGLThreadData *thread,
+                      GLuint         fbo )
+{
+     if (thread->bound_fbo == fbo)
+          return;
+
+     glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+
+     thread->bound_fbo = fbo;
+}
+
+static inline void
+egl_bind_texture( EGLThreadData *thread,
+                  GLuint         tex )
+{
+     int generation = __atomic_load_n( &thread->egl->tex_generation, __ATOMIC_ACQUIRE );
+
+     if (thread->bound_tex == tex && thread->tex_generation == generation)
+          return;
+
+     glBindTexture( GL_TEXTURE_2D, tex );
+
+     thread->bound_tex      = tex;
+     thread->tex_generation = generation;
+}
+
+static inline GLuint
+egl_bound_texture( EGLThreadData *thread )
+{
+     GLint tex;
+
+     if (thread->bound_tex == EGL_BINDING_UNKNOWN) {
+          glGetIntegerv( GL_TEXTURE_BINDING_2D, &tex );
+
+          thread->bound_tex = tex;
+     }
+
+     return thread->bound_tex;
+}
+
+/*
+ * Textures and framebuffer objects are not deleted where they are released, possibly in the middle of a frame and on
+ * any thread, but pushed to a lock-free list that is deleted in one batch after the next frame has been presented.
+ * Framebuffer objects of the other contexts are pushed to the list of the owning thread, which deletes them the next
+ * time it enters the pool.
+ */
+
+struct _EGLDeletion {
+     EGLDeletion *next;
+
+     GLuint       tex;
+     GLuint       fbo;
+     EGLContext   context;      /* context owning the framebuffer object */
+};
+
+static void
+egl_delete_link( EGLDeletion **list,
+                 EGLDeletion  *deletion )
+{
+     deletion->next = __atomic_load_n( list, __ATOMIC_RELAXED );
+
+     while (!__atomic_compare_exchange_n( list, &deletion->next, deletion, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED ));
+}
+
+static void
+egl_delete_push( EGLDeletion **list,
+                 GLuint        tex,
+                 GLuint        fbo,
+                 EGLContext    context )
+{
+     EGLDeletion *deletion;
+
+     deletion = D_CALLOC( 1, sizeof(EGLDeletion) );
+     if (!deletion) {
+          D_OOM();
+          return;
+     }
+
+     deletion->tex     = tex;
+     deletion->fbo     = fbo;
+     deletion->context = context;
+
+     egl_delete_link( list, deletion );
+}
+
+static void
+egl_delete_later( EGLData    *egl,
+                  GLuint      tex,
+                  GLuint      fbo,
+                  EGLContext  context )
+{
+     egl_delete_push( &egl->deletions, tex, fbo, context );
+}
+
+static void
+egl_delete_in_context( EGLData    *egl,
+                       GLuint      fbo,
+                       EGLContext  context )
+{
+     EGLThreadData *owner;
+
+     /* Without its thread, the context has been destroyed with its objects. */
+     direct_mutex_lock( &egl->threads_lock );
+
+     direct_list_foreach (owner, egl->threads) {
+          if (owner->context == context) {
+               egl_delete_push( &owner->deletions, 0, fbo, context );
+               break;
+          }
+     }
+
+     direct_mutex_unlock( &egl->threads_lock );
+}
+
+static void
+egl_alloc_delete( EGLData           *egl,
+                  EGLThreadData     *thread,
+                  EGLAllocationData *alloc )
+{
+     if (alloc->fbo) {
+          if (alloc->fbo_context == egl->main_thread.context) {
+               egl_delete_later( egl, 0, alloc->fbo, alloc->fbo_context );
+          }
+          else if (alloc->fbo_context == thread->context) {
+               if (thread->bound_fbo == alloc->fbo)
+                    thread->bound_fbo = 0;
+
+               glDeleteFramebuffers( 1, &alloc->fbo );
+          }
+          else
+               egl_delete_in_context( egl, alloc->fbo, alloc->fbo_context );
+     }
+
+     if (alloc->tex)
+          egl_delete_later( egl, alloc->tex, 0, EGL_NO_CONTEXT );
+
+     alloc->tex         = 0;
+     alloc->fbo         = 0;
+     alloc->fbo_context = EGL_NO_CONTEXT;
+}
+
+void
+egl_delete_deferred( EGLData *egl )
+{
+     EGLThreadData *thread;
+     EGLDeletion   *deletion;
+     EGLDeletion   *next;
+     GLuint         textures[64];
+     GLuint         framebuffers[64];
+     int            num_textures     = 0;
+     int            num_framebuffers = 0;
+
+     if (!__atomic_load_n( &egl->deletions, __ATOMIC_RELAXED ))
+          return;
+
+     deletion = __atomic_exchange_n( &egl->deletions, NULL, __ATOMIC_ACQUIRE );
+
+     thread = egl_thread_data( egl );
+
+     for (; deletion; deletion = next) {
+          next = deletion->next;
+
+          if (deletion->tex) {
+               if (thread->bound_tex == deletion->tex)
+                    thread->bound_tex = 0;
+
+               textures[num_textures++] = deletion->tex;
+          }
+
+          /* Deleting a bound object reverts the binding to zero. */
+          if (deletion->fbo && deletion->context == thread->context) {
+               if (thread->bound_fbo == deletion->fbo)
+                    thread->bound_fbo = 0;
+
+               framebuffers[num_framebuffers++] = deletion->fbo;
+          }
+
+          /* Framebuffer objects of the main context stay queued until the main thread drains the list. */
+          if (deletion->fbo && deletion->context != thread->context)
+               egl_delete_link( &egl->deletions, deletion );
+          else
+               D_FREE( deletion );
+
+          if (num_textures == D_ARRAY_SIZE(textures) || !next) {
+               glDeleteTextures( num_textures, textures );
+
+               /* Bindings recorded before the deletion no longer match. */
+               if (num_textures)
+                    __atomic_add_fetch( &egl->tex_generation, 1, __ATOMIC_RELEASE );
+
+               num_textures = 0;
+          }
+
+          if (num_framebuffers == D_ARRAY_SIZE(framebuffers) || !next) {
+               glDeleteFramebuffers( num_framebuffers, framebuffers );
+
+               num_framebuffers = 0;
+          }
+     }
+}
+
+void
+egl_delete_owned( EGLThreadData *thread )
+{
+     EGLDeletion *deletion;
+     EGLDeletion *next;
+
+     if (!__atomic_load_n( &thread->deletions, __ATOMIC_RELAXED ))
+          return;
+
+     deletion = __atomic_exchange_n( &thread->deletions, NULL, __ATOMIC_ACQUIRE );
+
+     for (; deletion; deletion = next) {
+          next = deletion->next;
+
+          if (thread->bound_fbo == deletion->fbo)
+               thread->bound_fbo = 0;
+
+          glDeleteFramebuffers( 1, &deletion->fbo );
+
+          D_FREE( deletion );
+     }
+}
+
+static void
+egl_alloc_storage( EGLThreadData     *thread,
+                   EGLAllocationData *alloc )
+{
+     GLuint tex;
+
+     if (alloc->tex)
+          return;
+
+     tex = egl_bound_texture( thread );
+
+     glGenTextures( 1, &alloc->tex );
+
+     egl_bind_texture( thread, alloc->tex );
+
+     glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, alloc->width, alloc->height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL );
+
+     egl_bind_texture( thread, tex );
+
+     D_DEBUG_AT( EGL_Surfaces, "  -> tex   %u (%dx%d)\n", alloc->tex, alloc->width, alloc->height );
+}
+
+static GLuint
+egl_alloc_framebuffer( EGLThreadData     *thread,
+                       EGLAllocationData *alloc )
+{
+     egl_alloc_storage( thread, alloc );
+
+     /* Framebuffer objects are not shared, other contexts attach the texture to their own framebuffer. */
+     if (alloc->fbo_context && alloc->fbo_context != thread->context) {
+          if (!thread->fbo)
+               glGenFramebuffers( 1, &thread->fbo );
+
+          egl_bind_framebuffer( thread, thread->fbo );
+
+          glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, alloc->tex, 0 );
+
+          return thread->fbo;
+     }
+
+     if (!alloc->fbo) {
+          glGenFramebuffers( 1, &alloc->fbo );
+
+          alloc->fbo_context = thread->context;
+
+          egl_bind_framebuffer( thread, alloc->fbo );
+
+          glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, alloc->tex, 0 );
+
+          D_DEBUG_AT( EGL_Surfaces, "  -> fbo   %u\n", alloc->fbo );
+     }
+
+     return alloc->fbo;
+}
+
+static inline bool
+egl_is_scanout( EGLData               *egl,
+                CoreSurfaceAllocation *allocation )
+{
+     /* Only the primary layer renders into the scanout surface, other layers use textures. */
+     return !egl->headless && (allocation->type & CSTF_LAYER) && allocation->surface->resource_id == DLID_PRIMARY;
+}
+
+/*
+ * Each allocation records a fence after GPU accesses, so that a subsequent lock only waits for the work on this
+ * allocation. Accesses from the context that inserted the fence are ordered by the command stream and do not wait.
+ *
+ * Fences are only flushed when inserted while other threads have a context, a client wait in the same context
+ * flushes them. A waiter in a context created after such a fence requests a flush, which the owning thread performs
+ * when entering the pool or presenting.
+ *
+ * With asynchronous uploads, the upload thread accesses fences outside of the surface locks, they are guarded by the
+ * upload lock then.
+ */
+
+static inline void
+egl_sync_lock( EGLPoolLocalData *local )
+{
+     if (local->upload_thread)
+          direct_mutex_lock( &local->upload_lock );
+}
+
+static inline void
+egl_sync_unlock( EGLPoolLocalData *local )
+{
+     if (local->upload_thread)
+          direct_mutex_unlock( &local->upload_lock );
+}
+
+void
+egl_flush_requested( EGLData       *egl,
+                     EGLThreadData *thread )
+{
+     int requests = __atomic_load_n( &egl->flush_requests, __ATOMIC_ACQUIRE );
+
+     if (thread->flush_seen == requests)
+          return;
+
+     thread->flush_seen = requests;
+
+     if (thread->flush_pending) {
+          glFlush();
+
+          thread->flush_pending = false;
+     }
+}
+
+static void
+egl_alloc_fence( EGLPoolLocalData  *local,
+                 EGLThreadData     *thread,
+                 EGLAllocationData *alloc )
+{
+     EGLData *egl = local->egl;
+
+     if (!egl->eglCreateSyncKHR)
+          return;
+
+     egl_sync_lock( local );
+
+     if (alloc->sync)
+          egl->eglDestroySyncKHR( egl->eglDisplay, alloc->sync );
+
+     alloc->sync         = egl->eglCreateSyncKHR( egl->eglDisplay, EGL_SYNC_FENCE_KHR, NULL );
+     alloc->sync_context = thread->context;
+     alloc->sync_flushed = __atomic_load_n( &egl->contexts, __ATOMIC_ACQUIRE ) > 0;
+
+     if (alloc->sync) {
+          if (alloc->sync_flushed)
+               glFlush();
+          else
+               thread->flush_pending = true;
+     }
+
+     egl_sync_unlock( local );
+}
+
+static bool
+egl_alloc_busy( EGLData           *egl,
+                EGLAllocationData *alloc )
+{
+     EGLint status;
+
+     if (!alloc->sync)
+          return false;
+
+     if (!egl->eglGetSyncAttribKHR( egl->eglDisplay, alloc->sync, EGL_SYNC_STATUS_KHR, &status ))
+          return true;
+
+     return status != EGL_SIGNALED_KHR;
+}
+
+static void
+egl_alloc_wait( EGLPoolLocalData  *local,
+                EGLThreadData     *thread,
+                EGLAllocationData *alloc,
+                bool               gpu )
+{
+     EGLData *egl = local->egl;
+
+     egl_sync_lock( local );
+
+     if (!alloc->sync || (gpu && alloc->sync_context == thread->context)) {
+          egl_sync_unlock( local );
+          return;
+     }
+
+     if (alloc->sync_context == thread->context) {
+          if (egl_alloc_busy( egl, alloc )) {
+               D_DEBUG_AT( EGL_SurfLock, "  -> waiting for fence %p\n", alloc->sync );
+
+               egl->eglClientWaitSyncKHR( egl->eglDisplay, alloc->sync, EGL_SYNC_FLUSH_COMMANDS_BIT_KHR,
+                                          EGL_FOREVER_KHR );
+          }
+     }
+     else {
+          if (egl_alloc_busy( egl, alloc )) {
+               D_DEBUG_AT( EGL_SurfLock, "  -> waiting for fence %p of another context\n", alloc->sync );
+
+               if (!alloc->sync_flushed) {
+                    __atomic_add_fetch( &egl->flush_requests, 1, __ATOMIC_RELEASE );
+
+                    /* Serve flush requests while waiting, the owning thread may wait for a fence of this one. */
+                    do {
+                         egl_flush_requested( egl, thread );
+                    } while (egl->eglClientWaitSyncKHR( egl->eglDisplay, alloc->sync, 0,
+                                                        1000000 ) == EGL_TIMEOUT_EXPIRED_KHR);
+               }
+               else if (gpu && egl->eglWaitSyncKHR)
+                    egl->eglWaitSyncKHR( egl->eglDisplay, alloc->sync, 0 );
+               else
+                    egl->eglClientWaitSyncKHR( egl->eglDisplay, alloc->sync, 0, EGL_FOREVER_KHR );
+          }
+     }
+
+     egl->eglDestroySyncKHR( egl->eglDisplay, alloc->sync );
+
+     alloc->sync = EGL_NO_SYNC_KHR;
+
+     egl_sync_unlock( local );
+}
+
+/*
+ * With the eglgbm-async-upload option, writes are copied into a staging ring and return immediately, a dedicated
+ * thread with its own context uploads them and inserts the fence of the allocation. Locks and synchronous accesses
+ * wait for the pending uploads of their allocation only.
+ */
+
+static void *
+egl_upload_loop( DirectThread *upload_thread,
+                 void         *arg )
+{
+     EGLPoolLocalData *local = arg;
+     EGLData          *egl   = local->egl;
+     EGLThreadData    *thread;
+     EGLUploadJob     *job;
+
+     D_DEBUG_AT( EGL_Surfaces, "%s()\n", __FUNCTION__ );
+
+     thread = egl_thread_data( egl );
+
+     direct_mutex_lock( &local->upload_lock );
+
+     while (true) {
+          job = (EGLUploadJob*) local->upload_jobs;
+
+          if (!job || !job->ready) {
+               if (local->upload_stop)
+                    break;
+
+               direct_waitqueue_wait( &local->upload_cond, &local->upload_lock );
+               continue;
+          }
+
+          /* The job stays in the list until done, keeping its space in the staging ring. */
+
+          direct_mutex_unlock( &local->upload_lock );
+
+          egl_alloc_wait( local, thread, job->alloc, true );
+
+          egl_bind_texture( thread, job->alloc->tex );
+
+          glTexSubImage2D( GL_TEXTURE_2D, 0, job->rect.x, job->rect.y, job->rect.w, job->rect.h,
+                           GL_BGRA_EXT, GL_UNSIGNED_BYTE, local->ring + job->offset );
+
+          egl_alloc_fence( local, thread, job->alloc );
+
+          direct_mutex_lock( &local->upload_lock );
+
+          direct_list_remove( &local->upload_jobs, &job->link );
+
+          if (local->upload_jobs) {
+               local->ring_tail = ((EGLUploadJob*) local->upload_jobs)->offset;
+          }
+          else {
+               local->ring_head = 0;
+               local->ring_tail = 0;
+          }
+
+          job->alloc->uploads--;
+
+          direct_waitqueue_broadcast( &local->upload_cond );
+
+          D_FREE( job );
+     }
+
+     direct_mutex_unlock( &local->upload_lock );
+
+     return NULL;
+}
+
+static void
+egl_upload_init( EGLPoolLocalData *local )
+{
+     const char *value;
+
+     if (!direct_config_has_name( "eglgbm-async-upload" ))
+          return;
+
+     if (!local->egl->surfaceless) {
+          D_WARN( "asynchronous uploads need EGL_KHR_surfaceless_context" );
+          return;
+     }
+
+     local->ring_size = 8 * 1024 * 1024;
+
+     if ((value = direct_config_get_value( "eglgbm-upload-ring" )))
+          local->ring_size = atoi( value ) * 1024;
+
+     local->ring = D_MALLOC( local->ring_size );
+     if (!local->ring) {
+          D_OOM();
+          return;
+     }
+
+     direct_mutex_init( &local->upload_lock );
+     direct_waitqueue_init( &local->upload_cond );
+
+     local->upload_thread = direct_thread_create( DTT_DEFAULT, egl_upload_loop, local, "EGL Upload" );
+
+     D_INFO( "EGL/Surfaces: Using asynchronous uploads with a %u KB staging ring\n", local->ring_size / 1024 );
+}
+
+static void
+egl_upload_deinit( EGLPoolLocalData *local )
+{
+     if (!local->upload_thread)
+          return;
+
+     direct_mutex_lock( &local->upload_lock );
+
+     local->upload_stop = true;
+
+     direct_waitqueue_broadcast( &local->upload_cond );
+
+     direct_mutex_unlock( &local->upload_lock );
+
+     direct_thread_join( local->upload_thread );
+     direct_thread_destroy( local->upload_thread );
+
+     local->upload_thread = NULL;
+
+     direct_waitqueue_deinit( &local->upload_cond );
+     direct_mutex_deinit( &local->upload_lock );
+
+     D_FREE( local->ring );
+}
+
+static void
+egl_upload_flush( EGLPoolLocalData  *local,
+                  EGLAllocationData *alloc )
+{
+     if (!local->upload_thread)
+          return;
+
+     direct_mutex_lock( &local->upload_lock );
+
+     while (alloc->uploads)
+          direct_waitqueue_wait( &local->upload_cond, &local->upload_lock );
+
+     direct_mutex_unlock( &local->upload_lock );
+}
+
+static bool
+egl_upload_queue( EGLPoolLocalData   *local,
+                  EGLAllocationData  *alloc,
+                  const void         *source,
+                  int                 pitch,
+                  const DFBRectangle *rect )
+{
+     EGLUploadJob *job;
+     unsigned int  length = rect->w * rect->h * 4;
+     unsigned int  offset;
+     int           y;
+
+     if (!local->upload_thread || length > local->ring_size / 2)
+          return false;
+
+     job = D_CALLOC( 1, sizeof(EGLUploadJob) );
+     if (!job) {
+          D_OOM();
+          return false;
+     }
+
+     direct_mutex_lock( &local->upload_lock );
+
+     /* Reserve contiguous space in the staging ring, waiting for completed uploads if needed. */
+     while (true) {
+          if (!local->upload_jobs) {
+               offset = 0;
+               break;
+          }
+
+          if (local->ring_head >= local->ring_tail) {
+               if (local->ring_head + length <= local->ring_size) {
+                    offset = local->ring_head;
+                    break;
+               }
+
+               if (length < local->ring_tail) {
+                    offset = 0;
+                    break;
+               }
+          }
+          else if (local->ring_head + length < local->ring_tail) {
+               offset = local->ring_head;
+               break;
+          }
+
+          direct_waitqueue_wait( &local->upload_cond, &local->upload_lock );
+     }
+
+     if (!local->upload_jobs)
+          local->ring_tail = 0;
+
+     local->ring_head = offset + length;
+
+     job->alloc  = alloc;
+     job->rect   = *rect;
+     job->offset = offset;
+     job->length = length;
+
+     alloc->uploads++;
+
+     direct_list_append( &local->upload_jobs, &job->link );
+
+     direct_mutex_unlock( &local->upload_lock );
+
+     /* The space is reserved, copy without holding the lock. */
+     for (y = 0; y < rect->h; y++)
+          direct_memcpy( local->ring + offset + y * rect->w * 4, (const u8*) source + y * pitch, rect->w * 4 );
+
+     direct_mutex_lock( &local->upload_lock );
+
+     job->ready = true;
+
+     direct_waitqueue_broadcast( &local->upload_cond );
+
+     direct_mutex_unlock( &local->upload_lock );
+
+     return true;
+}
+
+/*
+ * Texture storage is accounted per allocation type. With a video memory budget, creating storage beyond the budget
+ * first evicts the least recently locked allocations other than layers to system memory, their contents are uploaded
+ * again on their next use.
+ */
+
+static const char *alloc_type_names[EGL_ALLOC_NUM] = { "layer", "window", "cursor", "font", "other" };
+
+static EGLAllocType
+egl_alloc_type( CoreSurfaceAllocation *allocation )
+{
+     if (allocation->type & CSTF_LAYER)
+          return EGL_ALLOC_LAYER;
+
+     if (allocation->type & CSTF_WINDOW)
+          return EGL_ALLOC_WINDOW;
+
+     if (allocation->type & CSTF_CURSOR)
+          return EGL_ALLOC_CURSOR;
+
+     if (allocation->type & CSTF_FONT)
+          return EGL_ALLOC_FONT;
+
+     return EGL_ALLOC_OTHER;
+}
+
+static inline unsigned long
+egl_alloc_bytes( EGLAllocationData *alloc )
+{
+     if (alloc->blocks)
+          return alloc->blocks_size;
+
+     return (unsigned long) alloc->width * alloc->height * 4;
+}
+
+static inline GLenum
+egl_alloc_compressed_format( EGLAllocationData *alloc )
+{
+     return alloc->alpha ? GL_COMPRESSED_RGBA8_ETC2_EAC : GL_COMPRESSED_RGB8_ETC2;
+}
+
+static void
+egl_accounting_init( EGLPoolLocalData *local )
+{
+     direct_mutex_init( &local->lru_lock );
+     direct_waitqueue_init( &local->evict_cond );
+
+     local->budget = local->egl->videoram;
+
+     if (local->budget)
+          D_INFO( "EGL/Surfaces: Using a video memory budget of %lu KB\n", local->budget / 1024 );
+}
+
+static void
+egl_accounting_deinit( EGLPoolLocalData *local )
+{
+     int i;
+
+     for (i = 0; i < EGL_ALLOC_NUM; i++)
+          D_DEBUG_AT( EGL_Surfaces, "  -> %-6s %lu KB\n", alloc_type_names[i], local->used_by_type[i] / 1024 );
+
+     direct_waitqueue_deinit( &local->evict_cond );
+     direct_mutex_deinit( &local->lru_lock );
+}
+
+static void
+egl_alloc_pin( EGLPoolLocalData  *local,
+               EGLAllocationData *alloc )
+{
+     direct_mutex_lock( &local->lru_lock );
+
+     alloc->locks++;
+
+     while (alloc->evicting)
+          direct_waitqueue_wait( &local->evict_cond, &local->lru_lock );
+
+     /* The most recently locked allocation goes to the end. */
+     if (alloc->tex) {
+          direct_list_remove( &local->lru, &alloc->link );
+          direct_list_append( &local->lru, &alloc->link );
+     }
+
+     direct_mutex_unlock( &local->lru_lock );
+}
 
-typedef struct {
-     int    magic;
+static void
+egl_alloc_unpin( EGLPoolLocalData  *local,
+                 EGLAllocationData *alloc )
+{
+     direct_mutex_lock( &local->lru_lock );
 
-     int    pitch;
-     int    size;
+     alloc->locks--;
 
-     GLuint tex;
-     GLuint fbo;
-} EGLAllocationData;
+     direct_mutex_unlock( &local->lru_lock );
+}
+
+/*
+ * Victims are chosen with lru_lock held and evicted without it, as this waits for uploads and for fences. Fences of
+ * other contexts that are not flushed yet would need the owning thread, which may be waiting for the lock.
+ */
+static bool
+egl_alloc_evictable( EGLThreadData     *thread,
+                     EGLAllocationData *alloc )
+{
+     /* Framebuffer objects of other contexts can not be deleted here. */
+     if (alloc->fbo && alloc->fbo_context != thread->context)
+          return false;
+
+     if (alloc->sync && !alloc->sync_flushed && alloc->sync_context != thread->context)
+          return false;
+
+     return !alloc->locks && !alloc->compressing && !alloc->evicting && alloc->type != EGL_ALLOC_LAYER;
+}
+
+static bool
+egl_alloc_evict( EGLPoolLocalData  *local,
+                 EGLThreadData     *thread,
+                 EGLAllocationData *alloc )
+{
+     unsigned long size = egl_alloc_bytes( alloc );
+     GLuint        fbo;
+
+     /* Compressed allocations keep their blocks in system memory. */
+     if (!alloc->blocks) {
+          alloc->evicted = D_MALLOC( size );
+          if (!alloc->evicted)
+               return false;
+     }
+
+     egl_upload_flush( local, alloc );
+
+     egl_alloc_wait( local, thread, alloc, true );
+
+     if (alloc->evicted) {
+          glGenFramebuffers( 1, &fbo );
+          glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+          glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, alloc->tex, 0 );
+
+          glReadPixels( 0, 0, alloc->width, alloc->height, GL_RGBA, GL_UNSIGNED_BYTE, alloc->evicted );
+
+          glBindFramebuffer( GL_FRAMEBUFFER, thread->bound_fbo );
+          glDeleteFramebuffers( 1, &fbo );
+     }
+
+     egl_alloc_delete( local->egl, thread, alloc );
+
+     return true;
+}
+
+static void
+egl_alloc_resident( EGLPoolLocalData  *local,
+                    EGLThreadData     *thread,
+                    EGLAllocationData *alloc )
+{
+     unsigned long      size = egl_alloc_bytes( alloc );
+     EGLAllocationData *victim;
+     DirectLink        *link;
+     GLuint             tex;
+
+     direct_mutex_lock( &local->lru_lock );
+
+     if (alloc->tex) {
+          direct_mutex_unlock( &local->lru_lock );
+          return;
+     }
+
+     /* The memory of evicted textures is released after the next present. */
+     while (local->budget && local->used + size > local->budget) {
+          victim = NULL;
+
+          direct_list_foreach (link, local->lru) {
+               if (egl_alloc_evictable( thread, (EGLAllocationData*) link )) {
+                    victim = (EGLAllocationData*) link;
+                    break;
+               }
+          }
+
+          if (!victim)
+               break;
+
+          victim->evicting = true;
+
+          direct_mutex_unlock( &local->lru_lock );
+
+          if (!egl_alloc_evict( local, thread, victim )) {
+               direct_mutex_lock( &local->lru_lock );
+
+               victim->evicting = false;
+
+               direct_waitqueue_broadcast( &local->evict_cond );
+               break;
+          }
+
+          direct_mutex_lock( &local->lru_lock );
+
+          direct_list_remove( &local->lru, &victim->link );
+
+          local->used                      -= egl_alloc_bytes( victim );
+          local->used_by_type[victim->type] -= egl_alloc_bytes( victim );
+
+          victim->evicting = false;
+
+          direct_waitqueue_broadcast( &local->evict_cond );
+
+          D_DEBUG_AT( EGL_Surfaces, "  -> evicted %s %dx%d, %lu KB used\n",
+                      alloc_type_names[victim->type], victim->width, victim->height, local->used / 1024 );
+     }
+
+     if (local->budget && local->used + size > local->budget)
+          D_DEBUG_AT( EGL_Surfaces, "  -> over budget, %lu KB used\n", local->used / 1024 );
+
+     if (alloc->blocks) {
+          tex = egl_bound_texture( thread );
+
+          glGenTextures( 1, &alloc->tex );
+
+          egl_bind_texture( thread, alloc->tex );
+
+          glCompressedTexImage2D( GL_TEXTURE_2D, 0, egl_alloc_compressed_format( alloc ), alloc->width, alloc->height,
+                                  0, alloc->blocks_size, alloc->blocks );
+
+          egl_bind_texture( thread, tex );
+     }
+     else {
+          egl_alloc_storage( thread, alloc );
+     }
+
+     if (alloc->evicted) {
+          tex = egl_bound_texture( thread );
+
+          egl_bind_texture( thread, alloc->tex );
+
+          glTexSubImage2D( GL_TEXTURE_2D, 0, 0, 0, alloc->width, alloc->height, GL_RGBA, GL_UNSIGNED_BYTE,
+                           alloc->evicted );
+
+          egl_bind_texture( thread, tex );
+
+          D_FREE( alloc->evicted );
+
+          alloc->evicted = NULL;
+     }
+
+     local->used                     += size;
+     local->used_by_type[alloc->type] += size;
+
+     direct_list_append( &local->lru, &alloc->link );
+
+     direct_mutex_unlock( &local->lru_lock );
+}
+
+/*
+ * With the eglgbm-compress option, a thread with its own context replaces the textures of surfaces that have not been
+ * written for some time with ETC2 textures. The next write decompresses the blocks kept in system memory.
+ */
+
+static void
+egl_alloc_compress( EGLPoolLocalData  *local,
+                    EGLThreadData     *thread,
+                    EGLAllocationData *alloc )
+{
+     EGLData *egl  = local->egl;
+     size_t   size = egl_etc2_size( alloc->width, alloc->height, alloc->alpha );
+     u8      *pixels;
+     u8      *blocks;
+     GLuint   fbo, tex, compressed, old;
+
+     pixels = D_MALLOC( alloc->width * alloc->height * 4 );
+     blocks = D_MALLOC( size );
+     if (!pixels || !blocks) {
+          if (pixels)
+               D_FREE( pixels );
+
+          if (blocks)
+               D_FREE( blocks );
+
+          return;
+     }
+
+     egl_upload_flush( local, alloc );
+
+     egl_alloc_wait( local, thread, alloc, true );
+
+     glGenFramebuffers( 1, &fbo );
+     glBindFramebuffer( GL_FRAMEBUFFER, fbo );
+     glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, alloc->tex, 0 );
+
+     glReadPixels( 0, 0, alloc->width, alloc->height, GL_RGBA, GL_UNSIGNED_BYTE, pixels );
+
+     glBindFramebuffer( GL_FRAMEBUFFER, thread->bound_fbo );
+     glDeleteFramebuffers( 1, &fbo );
+
+     egl_etc2_encode( pixels, alloc->width * 4, alloc->width, alloc->height, alloc->alpha, blocks );
+
+     D_FREE( pixels );
+
+     tex = egl_bound_texture( thread );
+
+     glGenTextures( 1, &compressed );
+
+     egl_bind_texture( thread, compressed );
+
+     glCompressedTexImage2D( GL_TEXTURE_2D, 0, egl_alloc_compressed_format( alloc ), alloc->width, alloc->height, 0,
+                             size, blocks );
+
+     egl_bind_texture( thread, tex );
+
+     egl_alloc_fence( local, thread, alloc );
+
+     direct_mutex_lock( &local->lru_lock );
+
+     old = alloc->tex;
+
+     local->used                     -= egl_alloc_bytes( alloc );
+     local->used_by_type[alloc->type] -= egl_alloc_bytes( alloc );
+
+     alloc->tex         = compressed;
+     alloc->blocks      = blocks;
+     alloc->blocks_size = size;
+
+     local->used                     += size;
+     local->used_by_type[alloc->type] += size;
+
+     direct_mutex_unlock( &local->lru_lock );
+
+     egl_delete_later( egl, old, 0, EGL_NO_CONTEXT );
+
+     D_DEBUG_AT( EGL_Surfaces, "  -> compressed %s %dx%d to %zu KB\n",
+                 alloc_type_names[alloc->type], alloc->width, alloc->height, size / 1024 );
+}
+
+static void *
+egl_compress_loop( DirectThread *compress_thread,
+                   void         *arg )
+{
+     EGLPoolLocalData  *local = arg;
+     EGLThreadData     *thread;
+     EGLAllocationData *alloc;
+     DirectLink        *link;
+     long long          now;
+
+     D_DEBUG_AT( EGL_Surfaces, "%s()\n", __FUNCTION__ );
+
+     thread = egl_thread_data( local->egl );
+
+     direct_mutex_lock( &local->lru_lock );
+
+     while (!local->compress_stop) {
+          now   = direct_clock_get_abs_micros();
+          alloc = NULL;
+
+          /*
+           * Surfaces that are only sampled, layers and cursors are read back by the layers. Glyph edges do not survive
+           * the block compression.
+           */
+          direct_list_foreach (link, local->lru) {
+               EGLAllocationData *candidate = (EGLAllocationData*) link;
+
+               if (!candidate->locks && !candidate->evicting && !candidate->blocks && !candidate->fbo &&
+                   candidate->type != EGL_ALLOC_LAYER && candidate->type != EGL_ALLOC_CURSOR &&
+                   candidate->type != EGL_ALLOC_FONT &&
+                   now - candidate->written >= local->compress_idle) {
+                    alloc = candidate;
+                    break;
+               }
+          }
+
+          if (!alloc) {
+               direct_waitqueue_wait_timeout( &local->compress_cond, &local->lru_lock, 1000000 );
+               continue;
+          }
+
+          alloc->compressing = true;
+
+          direct_mutex_unlock( &local->lru_lock );
+
+          egl_alloc_compress( local, thread, alloc );
+
+          direct_mutex_lock( &local->lru_lock );
+
+          /* A failed compression is retried after the idle time. */
+          if (!alloc->blocks)
+               alloc->written = now;
+
+          alloc->compressing = false;
+
+          direct_waitqueue_broadcast( &local->compress_cond );
+     }
+
+     direct_mutex_unlock( &local->lru_lock );
+
+     return NULL;
+}
+
+static void
+egl_compress_init( EGLPoolLocalData *local )
+{
+     const char *value;
+     GLint       num   = 0;
+     GLint      *formats;
+     int         found = 0;
+     int         i;
+
+     if (!direct_config_has_name( "eglgbm-compress" ))
+          return;
+
+     if (!local->egl->surfaceless) {
+          D_WARN( "surface compression needs EGL_KHR_surfaceless_context" );
+          return;
+     }
+
+     glGetIntegerv( GL_NUM_COMPRESSED_TEXTURE_FORMATS, &num );
+
+     formats = D_CALLOC( num + 1, sizeof(GLint) );
+     if (!formats) {
+          D_OOM();
+          return;
+     }
+
+     glGetIntegerv( GL_COMPRESSED_TEXTURE_FORMATS, formats );
+
+     for (i = 0; i < num; i++) {
+          if (formats[i] == GL_COMPRESSED_RGB8_ETC2 || formats[i] == GL_COMPRESSED_RGBA8_ETC2_EAC)
+               found++;
+     }
+
+     D_FREE( formats );
+
+     if (found < 2) {
+          D_INFO( "EGL/Surfaces: ETC2 textures not supported, no surface compression\n" );
+          return;
+     }
+
+     local->compress_idle = 5000000;
+
+     if ((value = direct_config_get_value( "eglgbm-compress" )))
+          local->compress_idle = atoi( value ) * 1000000LL;
+
+     direct_waitqueue_init( &local->compress_cond );
+
+     local->compress_thread = direct_thread_create( DTT_DEFAULT, egl_compress_loop, local, "EGL Compress" );
+
+     D_INFO( "EGL/Surfaces: Compressing surfaces idle for %lld seconds\n", local->compress_idle / 1000000 );
+}
+
+static void
+egl_compress_deinit( EGLPoolLocalData *local )
+{
+     if (!local->compress_thread)
+          return;
+
+     direct_mutex_lock( &local->lru_lock );
+
+     local->compress_stop = true;
+
+     direct_waitqueue_broadcast( &local->compress_cond );
+
+     direct_mutex_unlock( &local->lru_lock );
+
+     direct_thread_join( local->compress_thread );
+     direct_thread_destroy( local->compress_thread );
+
+     local->compress_thread = NULL;
+
+     direct_waitqueue_deinit( &local->compress_cond );
+}
+
+static void
+egl_compress_flush( EGLPoolLocalData  *local,
+                    EGLAllocationData *alloc )
+{
+     if (!local->compress_thread)
+          return;
+
+     direct_mutex_lock( &local->lru_lock );
+
+     while (alloc->compressing)
+          direct_waitqueue_wait( &local->compress_cond, &local->lru_lock );
+
+     direct_mutex_unlock( &local->lru_lock );
+}
+
+static void
+egl_alloc_decompress( EGLPoolLocalData  *local,
+                      EGLThreadData     *thread,
+                      EGLAllocationData *alloc )
+{
+     if (!alloc->blocks)
+          return;
+
+     D_DEBUG_AT( EGL_Surfaces, "  -> decompressing %dx%d\n", alloc->width, alloc->height );
+
+     /* The contents are uploaded again with the uncompressed storage. */
+     alloc->evicted = D_MALLOC( alloc->width * alloc->height * 4 );
+     if (alloc->evicted)
+          egl_etc2_decode( alloc->blocks, alloc->width, alloc->height, alloc->alpha, alloc->evicted, alloc->width * 4 );
+     else
+          D_OOM();
+
+     direct_mutex_lock( &local->lru_lock );
+
+     if (alloc->tex) {
+          egl_alloc_delete( local->egl, thread, alloc );
+
+          direct_list_remove( &local->lru, &alloc->link );
+
+          local->used                     -= alloc->blocks_size;
+          local->used_by_type[alloc->type] -= alloc->blocks_size;
+     }
+
+     D_FREE( alloc->blocks );
+
+     alloc->blocks = NULL;
+
+     direct_mutex_unlock( &local->lru_lock );
+}
 
 /**********************************************************************************************************************/
 
+static int
+eglPoolLocalDataSize( void )
+{
+     return sizeof(EGLPoolLocalData);
+}
+
 static int
 eglAllocationDataSize( void )
 {
@@ -55,12 +1322,24 @@ eglInitPool( CoreDFB                    *core,
              void                       *system_data,
              CoreSurfacePoolDescription *ret_desc )
 {
+     EGLPoolLocalData *local = pool_local;
+
      D_DEBUG_AT( EGL_Surfaces, "%s()\n", __FUNCTION__ );
 
      D_ASSERT( core != NULL );
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+     D_ASSERT( system_data != NULL );
      D_ASSERT( ret_desc != NULL );
 
+     local->egl = system_data;
+
+     egl_upload_init( local );
+
+     egl_accounting_init( local );
+
+     egl_compress_init( local );
+
      ret_desc->caps              = CSPCAPS_VIRTUAL;
      ret_desc->access[CSAID_GPU] = CSAF_READ | CSAF_WRITE | CSAF_SHARED;
      ret_desc->types             = CSTF_LAYER | CSTF_WINDOW | CSTF_CURSOR | CSTF_FONT | CSTF_SHARED | CSTF_EXTERNAL;
@@ -68,6 +1347,7 @@ eglInitPool( CoreDFB                    *core,
 
      /* For hardware layers. */
      ret_desc->access[CSAID_LAYER0] = CSAF_READ | CSAF_SHARED;
+     ret_desc->access[CSAID_LAYER1] = CSAF_READ | CSAF_SHARED;
 
      snprintf( ret_desc->name, DFB_SURFACE_POOL_DESC_NAME_LENGTH, "EGL Surface Pool" );
 
@@ -81,10 +1361,22 @@ eglJoinPool( CoreDFB         *core,
              void            *pool_local,
              void            *system_data )
 {
+     EGLPoolLocalData *local = pool_local;
+
      D_DEBUG_AT( EGL_Surfaces, "%s()\n", __FUNCTION__ );
 
      D_ASSERT( core != NULL );
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+     D_ASSERT( system_data != NULL );
+
+     local->egl = system_data;
+
+     egl_upload_init( local );
+
+     egl_accounting_init( local );
+
+     egl_compress_init( local );
 
      return DFB_OK;
 }
@@ -94,9 +1386,20 @@ eglDestroyPool( CoreSurfacePool *pool,
                 void            *pool_data,
                 void            *pool_local )
 {
+     EGLPoolLocalData *local = pool_local;
+
      D_DEBUG_AT( EGL_Surfaces, "%s()\n", __FUNCTION__ );
 
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+
+     egl_upload_deinit( local );
+
+     egl_compress_deinit( local );
+
+     egl_delete_deferred( local->egl );
+
+     egl_accounting_deinit( local );
 
      return DFB_OK;
 }
@@ -106,9 +1409,20 @@ eglLeavePool( CoreSurfacePool *pool,
               void            *pool_data,
               void            *pool_local )
 {
+     EGLPoolLocalData *local = pool_local;
+
      D_DEBUG_AT( EGL_Surfaces, "%s()\n", __FUNCTION__ );
 
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
+
+     egl_upload_deinit( local );
+
+     egl_compress_deinit( local );
+
+     egl_delete_deferred( local->egl );
+
+     egl_accounting_deinit( local );
 
      return DFB_OK;
 }
@@ -139,8 +1453,6 @@ eglAllocateBuffer( CoreSurfacePool       *pool,
 {
      CoreSurface       *surface;
      EGLAllocationData *alloc = alloc_data;
-     GLint              tex;
-     GLint              fbo;
 
      D_DEBUG_AT( EGL_Surfaces, "%s( %p )\n", __FUNCTION__, buffer );
 
@@ -153,32 +1465,17 @@ eglAllocateBuffer( CoreSurfacePool       *pool,
      dfb_surface_calc_buffer_size( surface, 8, 1, &alloc->pitch, &alloc->size );
 
      D_DEBUG_AT( EGL_Surfaces, "  -> pitch %d\n", alloc->pitch );
-     D_DEBUG_AT( EGL_Surfaces, "  -> size  %d\n", alloc->pitch );
+     D_DEBUG_AT( EGL_Surfaces, "  -> size  %d\n", alloc->size );
 
      allocation->size   = alloc->size;
      allocation->offset = -1;
 
-     glGetIntegerv( GL_FRAMEBUFFER_BINDING, &fbo );
-     glGetIntegerv( GL_TEXTURE_BINDING_2D, &tex );
-
-     glGenTextures( 1, &alloc->tex );
-
-     glBindTexture( GL_TEXTURE_2D, alloc->tex );
-
-     glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA, surface->config.size.w, surface->config.size.h, 0,
-                   GL_RGBA, GL_UNSIGNED_BYTE, NULL );
-
-     glGenFramebuffers( 1, &alloc->fbo );
-
-     glBindFramebuffer( GL_FRAMEBUFFER, alloc->fbo );
-
-     glFramebufferTexture2D( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, alloc->tex, 0 );
-
-     glBindTexture( GL_TEXTURE_2D, tex );
-     glBindFramebuffer( GL_FRAMEBUFFER, fbo );
-
-     D_DEBUG_AT( EGL_Surfaces, "  -> tex   %u\n", alloc->tex );
-     D_DEBUG_AT( EGL_Surfaces, "  -> fbo   %u\n", alloc->fbo );
+     /* Texture storage and framebuffer object are created on demand. */
+     alloc->width   = surface->config.size.w;
+     alloc->height  = surface->config.size.h;
+     alloc->type    = egl_alloc_type( allocation );
+     alloc->alpha   = DFB_PIXELFORMAT_HAS_ALPHA( surface->config.format );
+     alloc->written = direct_clock_get_abs_micros();
 
      D_MAGIC_SET( alloc, EGLAllocationData );
 
@@ -193,20 +1490,54 @@ eglDeallocateBuffer( CoreSurfacePool       *pool,
                      CoreSurfaceAllocation *allocation,
                      void                  *alloc_data )
 {
+     EGLPoolLocalData  *local = pool_local;
      EGLAllocationData *alloc = alloc_data;
+     EGLData           *egl;
+     EGLThreadData     *thread;
 
      D_DEBUG_AT( EGL_Surfaces, "%s( %p )\n", __FUNCTION__, buffer );
 
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
      D_MAGIC_ASSERT( alloc, EGLAllocationData );
 
+     egl = local->egl;
+
      D_DEBUG_AT( EGL_Surfaces, "  -> pitch %d\n", alloc->pitch );
      D_DEBUG_AT( EGL_Surfaces, "  -> size  %d\n", alloc->size );
      D_DEBUG_AT( EGL_Surfaces, "  -> tex   %u\n", alloc->tex );
      D_DEBUG_AT( EGL_Surfaces, "  -> fbo   %u\n", alloc->fbo );
 
-     glDeleteFramebuffers( 1, &alloc->fbo );
-     glDeleteTextures( 1, &alloc->tex );
+     /* No compression starts on a pinned allocation. */
+     egl_alloc_pin( local, alloc );
+
+     egl_compress_flush( local, alloc );
+
+     egl_upload_flush( local, alloc );
+
+     if (alloc->sync)
+          egl->eglDestroySyncKHR( egl->eglDisplay, alloc->sync );
+
+     thread = egl_thread_data( egl );
+
+     if (alloc->tex) {
+          direct_mutex_lock( &local->lru_lock );
+
+          direct_list_remove( &local->lru, &alloc->link );
+
+          local->used                     -= egl_alloc_bytes( alloc );
+          local->used_by_type[alloc->type] -= egl_alloc_bytes( alloc );
+
+          direct_mutex_unlock( &local->lru_lock );
+     }
+
+     egl_alloc_delete( egl, thread, alloc );
+
+     if (alloc->evicted)
+          D_FREE( alloc->evicted );
+
+     if (alloc->blocks)
+          D_FREE( alloc->blocks );
 
      D_MAGIC_CLEAR( alloc );
 
@@ -221,29 +1552,74 @@ eglLock( CoreSurfacePool       *pool,
          void                  *alloc_data,
          CoreSurfaceBufferLock *lock )
 {
+     EGLPoolLocalData  *local = pool_local;
      EGLAllocationData *alloc = alloc_data;
+     EGLData           *egl;
+     EGLThreadData     *thread;
 
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
      D_MAGIC_ASSERT( allocation, CoreSurfaceAllocation );
      D_MAGIC_ASSERT( alloc, EGLAllocationData );
      D_MAGIC_ASSERT( lock, CoreSurfaceBufferLock );
 
      D_DEBUG_AT( EGL_SurfLock, "%s( %p, %p )\n", __FUNCTION__, allocation, lock->buffer );
 
+     egl    = local->egl;
+     thread = egl_thread_data( egl );
+
      lock->pitch  = alloc->pitch;
      lock->offset = ~0;
      lock->addr   = NULL;
      lock->phys   = 0;
 
+     egl_flush_requested( egl, thread );
+
+     egl_delete_owned( thread );
+
+     egl_alloc_pin( local, alloc );
+
+     egl_compress_flush( local, alloc );
+
+     egl_upload_flush( local, alloc );
+
+     egl_alloc_wait( local, thread, alloc, lock->accessor == CSAID_GPU );
+
+     /* Updates of the primary layer are only presented after a write. */
+     if ((lock->access & CSAF_WRITE) && (allocation->type & CSTF_LAYER) &&
+         allocation->surface->resource_id == DLID_PRIMARY)
+          egl->dirty = true;
+
      if (lock->accessor == CSAID_GPU) {
           if (lock->access & CSAF_WRITE) {
-               if (allocation->type & CSTF_LAYER)
-                    glBindFramebuffer( GL_FRAMEBUFFER, 0 );
-               else
-                    glBindFramebuffer( GL_FRAMEBUFFER, alloc->fbo );
+               if (egl_is_scanout( egl, allocation )) {
+                    /* A size change of the layer from another thread is applied before rendering the frame. */
+                    if (thread == &egl->main_thread)
+                         egl_resize_pending( egl );
+
+                    egl_bind_framebuffer( thread, 0 );
+               }
+               else {
+                    egl_alloc_decompress( local, thread, alloc );
+
+                    egl_alloc_resident( local, thread, alloc );
+
+                    egl_bind_framebuffer( thread, egl_alloc_framebuffer( thread, alloc ) );
+               }
           }
-          else
+          else {
+               egl_alloc_resident( local, thread, alloc );
+
                lock->handle = (void*)(long) alloc->tex;
+
+               thread->bound_tex = EGL_BINDING_UNKNOWN;
+          }
+     }
+     else if (lock->accessor == CSAID_LAYER0 || lock->accessor == CSAID_LAYER1) {
+          /* The headless primary layer reads back each frame, the cursor layer when its shape changes. */
+          egl_alloc_resident( local, thread, alloc );
+
+          lock->handle = (void*)(long) alloc->tex;
      }
 
      D_DEBUG_AT( EGL_SurfLock, "  -> offset %lu, pitch %u, addr %p, phys 0x%08lx\n",
@@ -260,17 +1636,26 @@ eglUnlock( CoreSurfacePool       *pool,
            void                  *alloc_data,
            CoreSurfaceBufferLock *lock )
 {
+     EGLPoolLocalData  *local = pool_local;
      EGLAllocationData *alloc = alloc_data;
 
-     D_UNUSED_P( alloc );
-
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
      D_MAGIC_ASSERT( allocation, CoreSurfaceAllocation );
      D_MAGIC_ASSERT( alloc, EGLAllocationData );
      D_MAGIC_ASSERT( lock, CoreSurfaceBufferLock );
 
      D_DEBUG_AT( EGL_SurfLock, "%s( %p, %p )\n", __FUNCTION__, allocation, lock->buffer );
 
+     /* Scanout buffers are synchronized by the swap. */
+     if (lock->accessor == CSAID_GPU && !egl_is_scanout( local->egl, allocation ))
+          egl_alloc_fence( local, egl_thread_data( local->egl ), alloc );
+
+     if (lock->access & CSAF_WRITE)
+          alloc->written = direct_clock_get_abs_micros();
+
+     egl_alloc_unpin( local, alloc );
+
      return DFB_OK;
 }
 
@@ -284,27 +1669,71 @@ eglWrite( CoreSurfacePool       *pool,
           int                    pitch,
           const DFBRectangle    *rect )
 {
+     EGLPoolLocalData  *local = pool_local;
      EGLAllocationData *alloc = alloc_data;
-     GLint              tex;
+     EGLData           *egl;
+     EGLThreadData     *thread;
+     GLuint             tex;
 
      D_MAGIC_ASSERT( pool, CoreSurfacePool );
+     D_ASSERT( local != NULL );
      D_MAGIC_ASSERT( allocation, CoreSurfaceAllocation );
      D_MAGIC_ASSERT( alloc, EGLAllocationData );
 
      D_DEBUG_AT( EGL_SurfLock, "%s( %p )\n", __FUNCTION__, allocation->buffer );
 
-     glGetIntegerv( GL_TEXTURE_BINDING_2D, &tex );
+     egl    = local->egl;
+     thread = egl_thread_data( egl );
+
+     egl_flush_requested( egl, thread );
+
+     egl_delete_owned( thread );
 
-     glBindTexture( GL_TEXTURE_2D, alloc->tex );
+     egl_alloc_pin( local, alloc );
+
+     egl_compress_flush( local, alloc );
+
+     alloc->written = direct_clock_get_abs_micros();
+
+     if ((allocation->type & CSTF_LAYER) && allocation->surface->resource_id == DLID_PRIMARY)
+          egl->dirty = true;
+
+     if (!alloc->tex || alloc->blocks) {
+          egl_alloc_decompress( local, thread, alloc );
+
+          egl_alloc_resident( local, thread, alloc );
+
+          /* Make the texture visible to the upload context. */
+          if (local->upload_thread)
+               glFlush();
+     }
+
+     if (egl_upload_queue( local, alloc, source, pitch, rect )) {
+          egl_alloc_unpin( local, alloc );
+          return DFB_OK;
+     }
+
+     egl_upload_flush( local, alloc );
+
+     egl_alloc_wait( local, thread, alloc, true );
+
+     tex = egl_bound_texture( thread );
+
+     egl_bind_texture( thread, alloc->tex );
 
      glTexSubImage2D( GL_TEXTURE_2D, 0, rect->x, rect->y, rect->w, rect->h, GL_BGRA_EXT, GL_UNSIGNED_BYTE, source );
 
-     glBindTexture( GL_TEXTURE_2D, tex );
+     egl_bind_texture( thread, tex );
+
+     egl_alloc_fence( local, thread, alloc );
+
+     egl_alloc_unpin( local, alloc );
 
      return DFB_OK;
 }
 
 const SurfacePoolFuncs eglSurfacePoolFuncs = {
+     .PoolLocalDataSize  = eglPoolLocalDataSize,
      .AllocationDataSize = eglAllocationDataSize,
      .InitPool           = eglInitPool,
      .JoinPool           = eglJoinPool,
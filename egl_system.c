@@ -22,6 +22,8 @@
 #include <core/screens.h>
 #include <core/surface_pool.h>
 #include <fusion/shmalloc.h>
+#include <misc/conf.h>
+#include <strings.h>
 
 #include "egl_system.h"
 
@@ -33,13 +35,30 @@ DFB_CORE_SYSTEM( eglgbm )
 
 extern const ScreenFuncs       eglScreenFuncs;
 extern const DisplayLayerFuncs eglPrimaryLayerFuncs;
+extern const DisplayLayerFuncs eglCursorLayerFuncs;
 extern const SurfacePoolFuncs  eglSurfacePoolFuncs;
+extern const SurfacePoolFuncs  eglDumbSurfacePoolFuncs;
+
+static bool
+device_has_node( drmDevice  *device,
+                 const char *name )
+{
+     int node;
+
+     for (node = 0; node < DRM_NODE_MAX; node++) {
+          if ((device->available_nodes & (1 << node)) && !strcmp( name, device->nodes[node] ))
+               return true;
+     }
+
+     return false;
+}
 
 static void
 get_device_info( EGLDataShared *shared )
 {
      int         max_devices, i;
      drmDevice **devices;
+     const char *name = *shared->render_name ? shared->render_name : shared->device_name;
 
      max_devices = drmGetDevices2( 0, NULL, 0 );
      if (max_devices <= 0)
@@ -53,11 +72,12 @@ get_device_info( EGLDataShared *shared )
 
      drmGetDevices2( 0, devices, max_devices );
 
+     /* The graphics driver runs on the render device. */
      for (i = 0; i < max_devices; i++) {
-          if (!(devices[i]->available_nodes & (1 << DRM_NODE_PRIMARY)))
-               continue;
+          if (*shared->render_name && device_has_node( devices[i], shared->device_name ))
+               D_INFO( "EGL/System: Display device %s (bus type %d)\n", shared->device_name, devices[i]->bustype );
 
-          if (!strcmp( shared->device_name, devices[i]->nodes[DRM_NODE_PRIMARY] )) {
+          if (device_has_node( devices[i], name )) {
                if (devices[i]->bustype == DRM_BUS_PCI) {
                     shared->pci.bus       = devices[i]->businfo.pci->bus;
                     shared->pci.dev       = devices[i]->businfo.pci->dev;
@@ -65,6 +85,39 @@ get_device_info( EGLDataShared *shared )
                     shared->device.vendor = devices[i]->deviceinfo.pci->vendor_id;
                     shared->device.model  = devices[i]->deviceinfo.pci->device_id;
                }
+
+               if (*shared->render_name)
+                    D_INFO( "EGL/System: Render device %s (bus type %d, %04x:%04x)\n", name, devices[i]->bustype,
+                            shared->device.vendor, shared->device.model );
+          }
+     }
+
+     drmFreeDevices( devices, max_devices );
+
+     D_FREE( devices );
+}
+
+static void
+find_render_node( EGLDataShared *shared )
+{
+     int         max_devices, i;
+     drmDevice **devices;
+
+     max_devices = drmGetDevices2( 0, NULL, 0 );
+     if (max_devices <= 0)
+          return;
+
+     devices = D_CALLOC( max_devices, sizeof(*devices) );
+     if (!devices) {
+          D_OOM();
+          return;
+     }
+
+     drmGetDevices2( 0, devices, max_devices );
+
+     for (i = 0; i < max_devices; i++) {
+          if (devices[i]->available_nodes & (1 << DRM_NODE_RENDER)) {
+               direct_snputs( shared->device_name, devices[i]->nodes[DRM_NODE_RENDER], 255 );
                break;
           }
      }
@@ -74,167 +127,1134 @@ get_device_info( EGLDataShared *shared )
      D_FREE( devices );
 }
 
+DFBResult
+egl_kms_object_init( int           fd,
+                     EGLKMSObject *object,
+                     uint32_t      id,
+                     uint32_t      type )
+{
+     int i;
+
+     object->id   = id;
+     object->type = type;
+
+     object->props = drmModeObjectGetProperties( fd, id, type );
+     if (!object->props)
+          return DFB_FAILURE;
+
+     object->props_info = D_CALLOC( object->props->count_props ?: 1, sizeof(drmModePropertyRes*) );
+     if (!object->props_info)
+          return D_OOM();
+
+     for (i = 0; i < object->props->count_props; i++)
+          object->props_info[i] = drmModeGetProperty( fd, object->props->props[i] );
+
+     return DFB_OK;
+}
+
+void
+egl_kms_object_deinit( EGLKMSObject *object )
+{
+     int i;
+
+     if (object->props_info) {
+          for (i = 0; i < object->props->count_props; i++) {
+               if (object->props_info[i])
+                    drmModeFreeProperty( object->props_info[i] );
+          }
+
+          D_FREE( object->props_info );
+     }
+
+     if (object->props)
+          drmModeFreeObjectProperties( object->props );
+
+     memset( object, 0, sizeof(EGLKMSObject) );
+}
+
+uint32_t
+egl_kms_find_plane( EGLData  *egl,
+                    int       crtc_index,
+                    uint64_t  plane_type )
+{
+     drmModePlaneRes *plane_res;
+     drmModePlane    *plane;
+     EGLKMSObject     object;
+     uint32_t         plane_id = 0;
+     uint32_t         type_id;
+     int              i, j;
+
+     plane_res = drmModeGetPlaneResources( egl->fd );
+     if (!plane_res)
+          return 0;
+
+     for (i = 0; i < plane_res->count_planes && !plane_id; i++) {
+          plane = drmModeGetPlane( egl->fd, plane_res->planes[i] );
+          if (!plane)
+               continue;
+
+          memset( &object, 0, sizeof(EGLKMSObject) );
+
+          if ((plane->possible_crtcs & (1 << crtc_index)) &&
+              egl_kms_object_init( egl->fd, &object, plane->plane_id, DRM_MODE_OBJECT_PLANE ) == DFB_OK) {
+               type_id = egl_kms_property_id( &object, "type" );
+
+               for (j = 0; j < object.props->count_props; j++) {
+                    if (object.props->props[j] == type_id && object.props->prop_values[j] == plane_type) {
+                         plane_id = plane->plane_id;
+                         break;
+                    }
+               }
+          }
+
+          egl_kms_object_deinit( &object );
+
+          drmModeFreePlane( plane );
+     }
+
+     drmModeFreePlaneResources( plane_res );
+
+     return plane_id;
+}
+
+void
+egl_kms_connector_name( const drmModeConnector *connector,
+                        char                   *buf,
+                        size_t                  size )
+{
+     const char *type = drmModeGetConnectorTypeName( connector->connector_type );
+
+     snprintf( buf, size, "%s-%u", type ?: "Unknown", connector->connector_type_id );
+}
+
 static DFBResult
-local_init( const char *device_name,
-            EGLData    *egl )
+atomic_init( EGLData *egl )
 {
-     CoreScreen   *screen;
-     EGLConfig     config;
-     EGLint        num_config;
-     const EGLint  config_attr[]  = { EGL_RED_SIZE,   8,
-                                      EGL_GREEN_SIZE, 8,
-                                      EGL_BLUE_SIZE,  8,
-                                      EGL_ALPHA_SIZE, 8,
-                                      EGL_NONE };
-     const EGLint  context_attr[] = { EGL_CONTEXT_CLIENT_VERSION, 2,
-                                      EGL_NONE };
-     int           i;
+     DFBResult ret;
+     uint32_t  plane_id;
+     int       i;
 
-     /* Open EGL display. */
-     egl->fd = open( device_name, O_RDWR );
-     if (egl->fd < 0) {
-          D_PERROR( "EGL/System: Failed to open '%s'!\n", device_name );
+     if (direct_config_has_name( "eglgbm-legacy" ))
+          return DFB_UNSUPPORTED;
+
+     if (drmSetClientCap( egl->fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1 ) ||
+         drmSetClientCap( egl->fd, DRM_CLIENT_CAP_ATOMIC, 1 ))
+          return DFB_UNSUPPORTED;
+
+     for (i = 0; i < egl->resources->count_crtcs; i++) {
+          if (egl->resources->crtcs[i] == egl->crtc->crtc_id) {
+               egl->crtc_index = i;
+               break;
+          }
+     }
+
+     plane_id = egl_kms_find_plane( egl, egl->crtc_index, DRM_PLANE_TYPE_PRIMARY );
+     if (!plane_id)
+          return DFB_UNSUPPORTED;
+
+     ret = egl_kms_object_init( egl->fd, &egl->kms_connector, egl->connector->connector_id, DRM_MODE_OBJECT_CONNECTOR );
+     if (ret)
+          return ret;
+
+     ret = egl_kms_object_init( egl->fd, &egl->kms_crtc, egl->crtc->crtc_id, DRM_MODE_OBJECT_CRTC );
+     if (ret)
+          return ret;
+
+     ret = egl_kms_object_init( egl->fd, &egl->kms_plane, plane_id, DRM_MODE_OBJECT_PLANE );
+     if (ret)
+          return ret;
+
+     if (drmModeCreatePropertyBlob( egl->fd, &egl->mode_info, sizeof(drmModeModeInfo), &egl->mode_blob ))
+          return DFB_FAILURE;
+
+     return DFB_OK;
+}
+
+static void
+get_plane_modifiers( EGLData *egl )
+{
+     drmModePropertyBlobRes                *blob;
+     const struct drm_format_modifier_blob *header;
+     const uint32_t                        *formats;
+     const struct drm_format_modifier      *mods;
+     uint64_t                               cap;
+     uint32_t                               prop_id;
+     int                                    i, j;
+     int                                    format_index = -1;
+
+     if (drmGetCap( egl->fd, DRM_CAP_ADDFB2_MODIFIERS, &cap ) || !cap)
+          return;
+
+     prop_id = egl_kms_property_id( &egl->kms_plane, "IN_FORMATS" );
+     if (!prop_id)
+          return;
+
+     for (i = 0; i < egl->kms_plane.props->count_props; i++) {
+          if (egl->kms_plane.props->props[i] == prop_id)
+               break;
+     }
+
+     blob = drmModeGetPropertyBlob( egl->fd, egl->kms_plane.props->prop_values[i] );
+     if (!blob)
+          return;
+
+     header  = blob->data;
+     formats = (const uint32_t*) ((const u8*) blob->data + header->formats_offset);
+     mods    = (const struct drm_format_modifier*) ((const u8*) blob->data + header->modifiers_offset);
+
+     for (i = 0; i < header->count_formats; i++) {
+          if (formats[i] == egl->format) {
+               format_index = i;
+               break;
+          }
+     }
+
+     if (format_index >= 0) {
+          egl->modifiers = D_CALLOC( header->count_modifiers ?: 1, sizeof(uint64_t) );
+          if (!egl->modifiers) {
+               D_OOM();
+               drmModeFreePropertyBlob( blob );
+               return;
+          }
+
+          /* Each modifier applies to a window of 64 formats starting at its offset. */
+          for (j = 0; j < header->count_modifiers; j++) {
+               if (format_index < mods[j].offset || format_index >= mods[j].offset + 64)
+                    continue;
+
+               if (!(mods[j].formats & (1ULL << (format_index - mods[j].offset))))
+                    continue;
+
+               if (mods[j].modifier == DRM_FORMAT_MOD_INVALID)
+                    continue;
+
+               D_DEBUG_AT( EGL_System, "  -> modifier 0x%016llx\n", (unsigned long long) mods[j].modifier );
+
+               egl->modifiers[egl->num_modifiers++] = mods[j].modifier;
+          }
+     }
+
+     drmModeFreePropertyBlob( blob );
+}
+
+static DFBResult
+create_scanout( EGLData *egl,
+                int      width,
+                int      height )
+{
+     struct gbm_device *gbm = egl->render_gbm ?: egl->gbm;
+
+     /* Let the driver pick the best layout (tiled, compressed) among the modifiers supported by the plane. */
+     if (egl->num_modifiers) {
+          egl->gbm_surface = gbm_surface_create_with_modifiers( gbm, width, height, egl->format,
+                                                                egl->modifiers, egl->num_modifiers );
+          if (!egl->gbm_surface)
+               D_DEBUG_AT( EGL_System, "  -> gbm_surface_create_with_modifiers() failed\n" );
+     }
+
+     /* A render device has no notion of scanout, the display device imports linear buffers. */
+     if (!egl->gbm_surface) {
+          egl->gbm_surface = gbm_surface_create( gbm, width, height, egl->format,
+                                                 egl->render_gbm ? GBM_BO_USE_RENDERING | GBM_BO_USE_LINEAR :
+                                                                   GBM_BO_USE_SCANOUT );
+          if (!egl->gbm_surface) {
+               D_ERROR( "EGL/System: gbm_surface_create() failed!\n" );
+               return DFB_INIT;
+          }
+     }
+
+     egl->eglSurface = eglCreateWindowSurface( egl->eglDisplay, egl->eglConfig, egl->gbm_surface, NULL );
+     if (!egl->eglSurface) {
+          D_ERROR( "EGL/System: eglCreateWindowSurface() failed: 0x%x!\n", (unsigned int) eglGetError() );
+          return DFB_INIT;
+     }
+
+     egl->scanout.w = width;
+     egl->scanout.h = height;
+
+     D_DEBUG_AT( EGL_System, "  -> scanout %dx%d\n", width, height );
+
+     return DFB_OK;
+}
+
+static uint64_t
+get_plane_rotations( EGLData *egl )
+{
+     drmModePropertyRes *prop;
+     uint64_t            rotations = 0;
+     int                 i, j;
+
+     for (i = 0; i < egl->kms_plane.props->count_props; i++) {
+          prop = egl->kms_plane.props_info[i];
+
+          if (!prop || strcmp( prop->name, "rotation" ) || !(prop->flags & DRM_MODE_PROP_BITMASK))
+               continue;
+
+          for (j = 0; j < prop->count_enums; j++)
+               rotations |= 1ULL << prop->enums[j].value;
+     }
+
+     return rotations;
+}
+
+static bool
+has_extension( const char *extensions,
+               const char *name )
+{
+     const char *ext = extensions;
+     size_t      len = strlen( name );
+
+     while (ext && (ext = strstr( ext, name ))) {
+          if ((ext == extensions || ext[-1] == ' ') && (ext[len] == ' ' || ext[len] == '\0'))
+               return true;
+
+          ext += len;
+     }
+
+     return false;
+}
+
+static const struct {
+     const char *name;
+     uint32_t    format;
+     EGLint      red, green, blue, alpha;
+} format_table[] = {
+     { "RGB565",      GBM_FORMAT_RGB565,       5,  6,  5, 0 },
+     { "XRGB8888",    GBM_FORMAT_XRGB8888,     8,  8,  8, 0 },
+     { "ARGB8888",    GBM_FORMAT_ARGB8888,     8,  8,  8, 8 },
+     { "XRGB2101010", GBM_FORMAT_XRGB2101010, 10, 10, 10, 0 },
+     { "ARGB2101010", GBM_FORMAT_ARGB2101010, 10, 10, 10, 2 }
+};
+
+static int
+get_format_index( void )
+{
+     const char *value;
+     int         i;
+
+     if ((value = direct_config_get_value( "eglgbm-format" ))) {
+          for (i = 0; i < D_ARRAY_SIZE(format_table); i++) {
+               if (!strcasecmp( value, format_table[i].name ))
+                    return i;
+          }
+
+          D_ERROR( "EGL/System: Unknown scanout format '%s'!\n", value );
+     }
+
+     /* Follow the pixel format of the primary layer. */
+     switch (dfb_config->mode.format) {
+          case DSPF_RGB16:
+               return 0;
+
+          default:
+               return 1;
+     }
+}
+
+static int
+find_format_index( uint32_t format )
+{
+     int i;
+
+     for (i = 0; i < D_ARRAY_SIZE(format_table); i++) {
+          if (format_table[i].format == format)
+               return i;
+     }
+
+     return -1;
+}
+
+static DFBResult
+choose_config( EGLData *egl,
+               int      format_index )
+{
+     EGLConfig *configs;
+     EGLint     num_configs;
+     EGLint     visual_id;
+     EGLint     depth, stencil, samples;
+     int        best       = -1;
+     int        best_score = 0;
+     int        i;
+     EGLint     config_attr[] = { EGL_RED_SIZE,        format_table[format_index].red,
+                                  EGL_GREEN_SIZE,      format_table[format_index].green,
+                                  EGL_BLUE_SIZE,       format_table[format_index].blue,
+                                  EGL_ALPHA_SIZE,      format_table[format_index].alpha,
+                                  EGL_DEPTH_SIZE,      0,
+                                  EGL_STENCIL_SIZE,    0,
+                                  EGL_SAMPLES,         0,
+                                  EGL_SURFACE_TYPE,    egl->headless ? 0 : EGL_WINDOW_BIT,
+                                  EGL_RENDERABLE_TYPE, EGL_OPENGL_ES2_BIT,
+                                  EGL_NONE };
+
+     if (!eglChooseConfig( egl->eglDisplay, config_attr, NULL, 0, &num_configs ) || num_configs < 1) {
+          D_ERROR( "EGL/System: eglChooseConfig() failed: 0x%x!\n", (unsigned int) eglGetError() );
           return DFB_INIT;
      }
 
-     egl->gbm = gbm_create_device( egl->fd );
-     if (!egl->gbm) {
-          D_ERROR( "EGL/System: gbm_create_device() failed!\n" );
+     configs = D_CALLOC( num_configs, sizeof(EGLConfig) );
+     if (!configs)
+          return D_OOM();
+
+     eglChooseConfig( egl->eglDisplay, config_attr, configs, num_configs, &num_configs );
+
+     /* The native visual of the config must match the scanout format. Sizes of 0 are minimums for eglChooseConfig(),
+        so the config without depth, stencil and multisample buffers is picked here, as they cost bandwidth in every
+        frame and are never used. */
+     for (i = 0; i < num_configs; i++) {
+          int score;
+
+          if (!egl->headless &&
+              (!eglGetConfigAttrib( egl->eglDisplay, configs[i], EGL_NATIVE_VISUAL_ID, &visual_id ) ||
+               (uint32_t) visual_id != egl->format))
+               continue;
+
+          eglGetConfigAttrib( egl->eglDisplay, configs[i], EGL_DEPTH_SIZE,   &depth );
+          eglGetConfigAttrib( egl->eglDisplay, configs[i], EGL_STENCIL_SIZE, &stencil );
+          eglGetConfigAttrib( egl->eglDisplay, configs[i], EGL_SAMPLES,      &samples );
+
+          score = depth + stencil + samples;
+
+          if (best == -1 || score < best_score) {
+               best       = i;
+               best_score = score;
+          }
+
+          if (!score)
+               break;
+     }
+
+     if (best == -1) {
+          D_WARN( "no config with %s native visual", format_table[format_index].name );
+          best = 0;
+     }
+     else if (best_score) {
+          D_WARN( "no config without depth, stencil or multisample buffers" );
+     }
+
+     D_DEBUG_AT( EGL_System, "  -> config %d of %d\n", best, num_configs );
+
+     egl->eglConfig = configs[best];
+
+     D_FREE( configs );
+
+     return DFB_OK;
+}
+
+static const struct {
+     const char *name;
+     EGLint      level;
+} priority_table[] = {
+     { "high",   EGL_CONTEXT_PRIORITY_HIGH_IMG   },
+     { "medium", EGL_CONTEXT_PRIORITY_MEDIUM_IMG },
+     { "low",    EGL_CONTEXT_PRIORITY_LOW_IMG    }
+};
+
+static const char *
+priority_name( EGLint level )
+{
+     int i;
+
+     for (i = 0; i < D_ARRAY_SIZE(priority_table); i++) {
+          if (priority_table[i].level == level)
+               return priority_table[i].name;
+     }
+
+     return "unknown";
+}
+
+static EGLint
+get_context_priority( EGLData *egl )
+{
+     const char *value;
+     int         i;
+
+     if ((value = direct_config_get_value( "eglgbm-context-priority" ))) {
+          for (i = 0; i < D_ARRAY_SIZE(priority_table); i++) {
+               if (!strcasecmp( value, priority_table[i].name ))
+                    return priority_table[i].level;
+          }
+
+          D_ERROR( "EGL/System: Unknown context priority '%s'!\n", value );
+     }
+
+     /* Frames presented by the master are scheduled before the work of other GPU clients. */
+     return dfb_core_is_master( egl->core ) ? EGL_CONTEXT_PRIORITY_HIGH_IMG : EGL_NONE;
+}
+
+static void
+set_context_attributes( EGLData    *egl,
+                        const char *extensions )
+{
+     EGLint *attr = egl->context_attr;
+
+     *attr++ = EGL_CONTEXT_CLIENT_VERSION;
+     *attr++ = 2;
+
+     egl->context_priority = EGL_NONE;
+
+     if (has_extension( extensions, "EGL_IMG_context_priority" )) {
+          egl->context_priority = get_context_priority( egl );
+
+          if (egl->context_priority != EGL_NONE) {
+               *attr++ = EGL_CONTEXT_PRIORITY_LEVEL_IMG;
+               *attr++ = egl->context_priority;
+          }
+     }
+
+     *attr = EGL_NONE;
+}
+
+static void
+thread_data_destroy( void *arg )
+{
+     EGLThreadData *thread = arg;
+     EGLData       *egl    = thread->egl;
+
+     if (thread == &egl->main_thread)
+          return;
+
+     direct_mutex_lock( &egl->threads_lock );
+     direct_list_remove( &egl->threads, &thread->link );
+     direct_mutex_unlock( &egl->threads_lock );
+
+     egl_delete_owned( thread );
+
+     if (thread->fbo)
+          glDeleteFramebuffers( 1, &thread->fbo );
+
+     eglMakeCurrent( egl->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+     eglDestroyContext( egl->eglDisplay, thread->context );
+     eglReleaseThread();
+
+     __atomic_sub_fetch( &egl->contexts, 1, __ATOMIC_RELEASE );
+
+     D_FREE( thread );
+}
+
+static bool
+connector_matches( EGLData          *egl,
+                   drmModeConnector *connector,
+                   const char       *names )
+{
+     char   name[32];
+     size_t length;
+
+     egl_kms_connector_name( connector, name, sizeof(name) );
+
+     if (!names) {
+          direct_snputs( egl->connector_name, name, sizeof(egl->connector_name) );
+          return true;
+     }
+
+     length = strcspn( names, "," );
+
+     if (strlen( name ) != length || strncasecmp( name, names, length ))
+          return false;
+
+     direct_snputs( egl->connector_name, name, sizeof(egl->connector_name) );
+
+     return true;
+}
+
+static drmModeConnector *
+find_connector( EGLData    *egl,
+                const char *names )
+{
+     drmModeConnector *connector;
+     const char       *name;
+     int               i;
+
+     /* Names in the order of priority, the first connected one is used. */
+     for (name = names; name; name = strchr( name, ',' ) ? strchr( name, ',' ) + 1 : NULL) {
+          for (i = 0; i < egl->resources->count_connectors; i++) {
+               connector = drmModeGetConnector( egl->fd, egl->resources->connectors[i] );
+               if (!connector)
+                    continue;
+
+               if (connector->connection == DRM_MODE_CONNECTED && connector_matches( egl, connector, name ))
+                    return connector;
+
+               drmModeFreeConnector( connector );
+          }
+     }
+
+     if (names)
+          D_WARN( "none of the connectors '%s' is connected", names );
+
+     for (i = 0; i < egl->resources->count_connectors; i++) {
+          connector = drmModeGetConnector( egl->fd, egl->resources->connectors[i] );
+          if (!connector)
+               continue;
+
+          if (connector->connection == DRM_MODE_CONNECTED && connector_matches( egl, connector, NULL ))
+               return connector;
+
+          drmModeFreeConnector( connector );
+     }
+
+     return NULL;
+}
+
+static const drmModeModeInfo *
+choose_mode( EGLData *egl,
+             int      refresh )
+{
+     const drmModeModeInfo *preferred = &egl->connector->modes[0];
+     const drmModeModeInfo *mode;
+     int                    i;
+
+     /* The preferred mode is usually the first one, but not always. */
+     for (i = 0; i < egl->connector->count_modes; i++) {
+          if (egl->connector->modes[i].type & DRM_MODE_TYPE_PREFERRED) {
+               preferred = &egl->connector->modes[i];
+               break;
+          }
+     }
+
+     if (!refresh)
+          return preferred;
+
+     /* Closest refresh rate at the resolution of the preferred mode. */
+     mode = preferred;
+
+     for (i = 0; i < egl->connector->count_modes; i++) {
+          const drmModeModeInfo *candidate = &egl->connector->modes[i];
+
+          if (candidate->hdisplay == preferred->hdisplay && candidate->vdisplay == preferred->vdisplay &&
+              (candidate->flags & DRM_MODE_FLAG_INTERLACE) == (preferred->flags & DRM_MODE_FLAG_INTERLACE) &&
+              abs( (int) candidate->vrefresh - refresh ) < abs( (int) mode->vrefresh - refresh ))
+               mode = candidate;
+     }
+
+     if (mode->vrefresh != refresh)
+          D_INFO( "EGL/System: No %d Hz mode at %dx%d, using %d Hz\n",
+                  refresh, preferred->hdisplay, preferred->vdisplay, mode->vrefresh );
+
+     return mode;
+}
+
+static void
+idle_init( EGLData *egl,
+           int      seconds )
+{
+     drmModeModeInfo *mode = NULL;
+     int              i;
+
+     /* Same resolution, so that only the refresh rate changes. */
+     for (i = 0; i < egl->connector->count_modes; i++) {
+          drmModeModeInfo *candidate = &egl->connector->modes[i];
+
+          if (candidate->hdisplay == egl->mode_info.hdisplay && candidate->vdisplay == egl->mode_info.vdisplay &&
+              (candidate->flags & DRM_MODE_FLAG_INTERLACE) == (egl->mode_info.flags & DRM_MODE_FLAG_INTERLACE) &&
+              candidate->vrefresh < (mode ? mode->vrefresh : egl->mode_info.vrefresh))
+               mode = candidate;
+     }
+
+     if (!mode) {
+          D_INFO( "EGL/System: No lower refresh rate at %dx%d\n", egl->mode_info.hdisplay, egl->mode_info.vdisplay );
+          return;
+     }
+
+     if (egl->atomic && drmModeCreatePropertyBlob( egl->fd, mode, sizeof(drmModeModeInfo), &egl->idle_blob )) {
+          D_PERROR( "EGL/System: Could not create idle mode blob!\n" );
+          return;
+     }
+
+     egl->idle_mode = *mode;
+     egl->idle_time = seconds * 1000000LL;
+
+     D_INFO( "EGL/System: Switching to %d Hz after %d seconds without changes\n", mode->vrefresh, seconds );
+
+     egl_idle_start( egl );
+}
+
+static DFBResult
+kms_init( EGLData *egl )
+{
+     const char *value;
+     int         i;
+
+     /* Retrieve display information. */
+     egl->resources = drmModeGetResources( egl->fd );
+     if (!egl->resources) {
+          D_PERROR( "EGL/System: Could not retrieve resources!\n" );
+          return DFB_INIT;
+     }
+
+     egl->connector = find_connector( egl, direct_config_get_value( "eglgbm-connector" ) );
+     if (!egl->connector) {
+          D_ERROR( "EGL/System: Cannot find connector!\n" );
+          return DFB_INIT;
+     }
+
+     if (egl->connector->encoder_id) {
+          egl->encoder = drmModeGetEncoder( egl->fd, egl->connector->encoder_id );
+     }
+     else {
+          for (i = 0; i < egl->connector->count_encoders; i++) {
+               egl->encoder = drmModeGetEncoder( egl->fd, egl->connector->encoders[i] );
+               if (!egl->encoder)
+                    continue;
+
+               break;
+          }
+     }
+
+     if (!egl->encoder) {
+          D_ERROR( "EGL/System: Cannot find encoder!\n" );
+          return DFB_INIT;
+     }
+
+     if (egl->encoder->crtc_id) {
+          egl->crtc = drmModeGetCrtc( egl->fd, egl->encoder->crtc_id );
+     }
+     else {
+          for (i = 0; i < egl->resources->count_crtcs; i++) {
+               if (egl->encoder->possible_crtcs & (1 << i))
+                    break;
+          }
+
+          if (i < egl->resources->count_crtcs)
+               egl->crtc = drmModeGetCrtc( egl->fd, egl->resources->crtcs[i] );
+     }
+
+     if (!egl->crtc) {
+          D_ERROR( "EGL/System: Cannot find crtc!\n" );
+          return DFB_INIT;
+     }
+
+     if (!egl->connector->count_modes) {
+          D_ERROR( "EGL/System: No modes on connector %s!\n", egl->connector_name );
+          return DFB_INIT;
+     }
+
+     value = direct_config_get_value( "eglgbm-refresh" );
+
+     egl->mode_info = *choose_mode( egl, value ? atoi( value ) : 0 );
+
+     egl->size.w = egl->mode_info.hdisplay;
+     egl->size.h = egl->mode_info.vdisplay;
+
+     egl->modeset = true;
+
+     D_INFO( "EGL/System: Found display configuration: %s at %dx%d %d Hz\n", egl->connector_name,
+             egl->mode_info.hdisplay, egl->mode_info.vdisplay, egl->mode_info.vrefresh );
+
+     /* Use atomic mode setting if available, with explicit synchronization if supported by EGL and KMS. */
+     if (atomic_init( egl ) == DFB_OK) {
+          egl->atomic = true;
+
+          if (!direct_config_has_name( "eglgbm-linear" ))
+               get_plane_modifiers( egl );
+
+          egl->rotations = get_plane_rotations( egl );
+
+          egl->explicit_sync = egl->eglDupNativeFenceFDANDROID &&
+                               egl_kms_property_id( &egl->kms_plane, "IN_FENCE_FD" ) &&
+                               egl_kms_property_id( &egl->kms_crtc, "OUT_FENCE_PTR" );
+
+          D_INFO( "EGL/System: Using atomic mode setting with %s synchronization\n",
+                  egl->explicit_sync ? "explicit" : "implicit" );
+
+          /* Capture the composed output with a writeback connector. */
+          if ((value = direct_config_get_value( "eglgbm-writeback" ))) {
+               const char *interval = direct_config_get_value( "eglgbm-writeback-interval" );
+
+               egl_writeback_init( egl, value, interval ? atoi( interval ) : 1 );
+          }
+
+          /* Lease a plane or a connector to another process, which requires DRM master. */
+          if ((value = direct_config_get_value( "eglgbm-lease" )) && dfb_core_is_master( egl->core ))
+               egl_lease_init( egl, value, direct_config_get_value( "eglgbm-lease-connector" ) );
+     }
+     else {
+          egl_kms_object_deinit( &egl->kms_connector );
+          egl_kms_object_deinit( &egl->kms_crtc );
+          egl_kms_object_deinit( &egl->kms_plane );
+
+          if (egl->mode_blob) {
+               drmModeDestroyPropertyBlob( egl->fd, egl->mode_blob );
+               egl->mode_blob = 0;
+          }
+
+          D_INFO( "EGL/System: Using legacy mode setting\n" );
+     }
+
+     /* Mode changes require DRM master. */
+     if ((value = direct_config_get_value( "eglgbm-idle-refresh" )) && dfb_core_is_master( egl->core ))
+          idle_init( egl, atoi( value ) );
+
+     return DFB_OK;
+}
+
+static void
+prime_probe( EGLData *egl )
+{
+     struct gbm_bo *bo = NULL;
+
+     if (egl->num_modifiers)
+          bo = gbm_bo_create_with_modifiers( egl->render_gbm, 64, 64, egl->format, egl->modifiers,
+                                             egl->num_modifiers );
+
+     /* The display device must import the layouts chosen by the render device, otherwise buffers are linear. */
+     if (bo && egl_bo_get_fb( egl, bo )) {
+          D_INFO( "EGL/System: Scanning out render buffers with modifier 0x%016llx\n",
+                  (unsigned long long) gbm_bo_get_modifier( bo ) );
+     }
+     else {
+          D_INFO( "EGL/System: Scanning out linear render buffers\n" );
+
+          egl->num_modifiers = 0;
+     }
+
+     if (bo)
+          gbm_bo_destroy( bo );
+}
+
+static DFBResult
+gl_init( EGLData *egl,
+         int      format_index )
+{
+     DFBResult   ret;
+     const char *extensions;
+     const char *value;
+
+     if (!egl->eglDisplay) {
+          D_ERROR( "EGL/System: eglGetDisplay() failed: 0x%x!\n", (unsigned int) eglGetError() );
+          return DFB_INIT;
+     }
+
+     if (!eglInitialize( egl->eglDisplay, NULL, NULL )) {
+          D_ERROR( "EGL/System: eglInitialize() failed: 0x%x!\n", (unsigned int) eglGetError() );
+          return DFB_INIT;
+     }
+
+     extensions = eglQueryString( egl->eglDisplay, EGL_EXTENSIONS );
+
+     if (has_extension( extensions, "EGL_KHR_fence_sync" )) {
+          egl->eglCreateSyncKHR     = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress( "eglCreateSyncKHR" );
+          egl->eglDestroySyncKHR    = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress( "eglDestroySyncKHR" );
+          egl->eglClientWaitSyncKHR = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress( "eglClientWaitSyncKHR" );
+          egl->eglGetSyncAttribKHR  = (PFNEGLGETSYNCATTRIBKHRPROC) eglGetProcAddress( "eglGetSyncAttribKHR" );
+
+          if (has_extension( extensions, "EGL_KHR_wait_sync" ))
+               egl->eglWaitSyncKHR = (PFNEGLWAITSYNCKHRPROC) eglGetProcAddress( "eglWaitSyncKHR" );
+
+          D_INFO( "EGL/System: Using fence sync objects%s\n", egl->eglWaitSyncKHR ? " with server-side waits" : "" );
+
+          if (has_extension( extensions, "EGL_ANDROID_native_fence_sync" ))
+               egl->eglDupNativeFenceFDANDROID =
+                    (PFNEGLDUPNATIVEFENCEFDANDROIDPROC) eglGetProcAddress( "eglDupNativeFenceFDANDROID" );
+     }
+
+     egl->surfaceless = has_extension( extensions, "EGL_KHR_surfaceless_context" );
+
+     /* Without a config, the contexts can be made current with a scanout surface of another format. */
+     egl->no_config = has_extension( extensions, "EGL_KHR_no_config_context" );
+
+     set_context_attributes( egl, extensions );
+
+     ret = choose_config( egl, format_index );
+     if (ret)
+          return ret;
+     if (egl->headless) {
+          if (!egl->surfaceless) {
+               D_ERROR( "EGL/System: Headless mode needs EGL_KHR_surfaceless_context!\n" );
+               return DFB_INIT;
+          }
+
+          /* Offscreen rendering, frames are delivered to the sink. */
+          egl->size.w = dfb_config->mode.width  ?: 1280;
+          egl->size.h = dfb_config->mode.height ?: 720;
+
+          D_INFO( "EGL/System: Headless mode (%dx%d)\n", egl->size.w, egl->size.h );
+
+          if ((value = direct_config_get_value( "eglgbm-sink" ))) {
+               ret = egl_sink_open( value, &egl->sink );
+               if (ret)
+                    return ret;
+          }
+     }
+     else {
+          ret = kms_init( egl );
+          if (ret)
+               return ret;
+
+          if (egl->render_gbm)
+               prime_probe( egl );
+
+          /* Create EGL window surface. */
+          ret = create_scanout( egl, egl->size.w, egl->size.h );
+          if (ret)
+               return ret;
+
+          if ((value = direct_config_get_value( "eglgbm-export" ))) {
+               ret = egl_export_init( egl, value );
+               if (ret)
+                    return ret;
+          }
+     }
+
+     /* Create EGL context and attach it to the EGL window surface. */
+     egl->eglContext = eglCreateContext( egl->eglDisplay, egl->no_config ? EGL_NO_CONFIG_KHR : egl->eglConfig,
+                                         EGL_NO_CONTEXT, egl->context_attr );
+     if (!egl->eglContext) {
+          D_ERROR( "EGL/System: eglCreateContext() failed: 0x%x!\n", (unsigned int) eglGetError() );
           return DFB_INIT;
      }
 
-     egl->eglDisplay = eglGetDisplay( egl->gbm );
-     if (!egl->eglDisplay) {
-          D_ERROR( "EGL/System: eglGetDisplay() failed: 0x%x!\n", (unsigned int) eglGetError() );
-          return DFB_INIT;
-     }
+     /* The granted priority may be lower than requested, e.g. without CAP_SYS_NICE. */
+     if (egl->context_priority != EGL_NONE) {
+          EGLint granted = EGL_NONE;
 
-     if (!eglInitialize( egl->eglDisplay, NULL, NULL )) {
-          D_ERROR( "EGL/System: eglInitialize() failed: 0x%x!\n", (unsigned int) eglGetError() );
-          return DFB_INIT;
+          eglQueryContext( egl->eglDisplay, egl->eglContext, EGL_CONTEXT_PRIORITY_LEVEL_IMG, &granted );
+
+          if (granted == egl->context_priority)
+               D_INFO( "EGL/System: Using %s context priority\n", priority_name( granted ) );
+          else
+               D_INFO( "EGL/System: Using %s context priority (%s requested)\n",
+                       priority_name( granted ), priority_name( egl->context_priority ) );
      }
 
-     if (!eglChooseConfig( egl->eglDisplay, config_attr, &config, 1, &num_config ) || (num_config != 1)) {
-          D_ERROR("DirectFB/EGL: eglChooseConfig() failed: 0x%x!\n", (unsigned int) eglGetError() );
+     if (!eglMakeCurrent( egl->eglDisplay, egl->eglSurface, egl->eglSurface, egl->eglContext )) {
+          D_ERROR( "EGL/System: eglMakeCurrent() failed: 0x%x!\n", (unsigned int) eglGetError() );
           return DFB_INIT;
      }
 
-     /* Retrieve display information. */
-     egl->resources = drmModeGetResources( egl->fd );
-     if (!egl->resources) {
-          D_PERROR( "EGL/System: Could not retrieve resources!\n" );
+     /* Other threads get their own context sharing objects with this one. */
+     egl->main_thread.egl     = egl;
+     egl->main_thread.context = egl->eglContext;
+
+     direct_mutex_init( &egl->threads_lock );
+
+     if (direct_tls_register( &egl->thread_key, thread_data_destroy )) {
+          D_ERROR( "EGL/System: Failed to register thread local storage!\n" );
           return DFB_INIT;
      }
 
-     for (i = 0; i < egl->resources->count_connectors; i++) {
-          egl->connector = drmModeGetConnector( egl->fd, egl->resources->connectors[i] );
-          if (!egl->connector)
-               continue;
+     direct_tls_set( &egl->thread_key, &egl->main_thread );
 
-          if (egl->connector->connection == DRM_MODE_CONNECTED)
-               break;
+     return DFB_OK;
+}
 
-          drmModeFreeConnector( egl->connector );
-          egl->connector = NULL;
-     }
+static DFBResult
+local_init( const char *device_name,
+            EGLData    *egl )
+{
+     DFBResult     ret;
+     CoreScreen   *screen;
+     int           format_index;
+     const char   *value;
 
-     if (!egl->connector) {
-          D_ERROR( "EGL/System: Cannot find connector!\n" );
-          return DFB_INIT;
-     }
+     egl->out_fence = -1;
+     egl->render_fd = -1;
 
-     if (egl->connector->encoder_id) {
-          egl->encoder = drmModeGetEncoder( egl->fd, egl->connector->encoder_id );
-     }
-     else {
-          for (i = 0; i < egl->resources->count_encoders; i++) {
-               egl->encoder = drmModeGetEncoder( egl->fd, egl->connector->encoders[i] );
-               if (!egl->encoder)
-                    continue;
+     format_index = get_format_index();
 
-               break;
+     egl->format = format_table[format_index].format;
+
+     D_INFO( "EGL/System: Using %s scanout format\n", format_table[format_index].name );
+
+     egl->headless  = direct_config_has_name( "eglgbm-headless" );
+     egl->dumb      = !egl->headless && direct_config_has_name( "eglgbm-dumb" );
+     egl->idle_skip = !direct_config_has_name( "eglgbm-no-idle-skip" );
+
+     if ((value = direct_config_get_value( "eglgbm-videoram" )))
+          egl->videoram = strtoul( value, NULL, 10 ) * 1024 * 1024;
+
+     /* Open EGL display. */
+     if (egl->headless && !*device_name) {
+          PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display;
+
+          /* No render node, e.g. software rendering on a machine without GPU. */
+          get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress( "eglGetPlatformDisplayEXT" );
+
+          if (!get_platform_display ||
+              !has_extension( eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS ), "EGL_MESA_platform_surfaceless" )) {
+               D_ERROR( "EGL/System: No render node and no surfaceless platform!\n" );
+               return DFB_INIT;
           }
-     }
 
-     if (!egl->encoder) {
-          D_ERROR( "EGL/System: Cannot find encoder!\n" );
-          return DFB_INIT;
-     }
+          egl->fd = -1;
 
-     if (egl->encoder->crtc_id) {
-          egl->crtc = drmModeGetCrtc( egl->fd, egl->encoder->crtc_id );
+          egl->eglDisplay = get_platform_display( EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL );
      }
      else {
-          for (i = 0; i < egl->resources->count_crtcs; i++) {
-               if (egl->encoder->possible_crtcs & (1 << i))
-                    break;
+          egl->fd = open( device_name, O_RDWR );
+          if (egl->fd < 0) {
+               D_PERROR( "EGL/System: Failed to open '%s'!\n", device_name );
+               return DFB_INIT;
           }
 
-          egl->crtc = drmModeGetCrtc( egl->fd, egl->resources->crtcs[i] );
-     }
+          egl->gbm = gbm_create_device( egl->fd );
+          if (!egl->gbm) {
+               D_ERROR( "EGL/System: gbm_create_device() failed!\n" );
+               return DFB_INIT;
+          }
 
-     if (!egl->crtc) {
-          D_ERROR( "EGL/System: Cannot find crtc!\n" );
-          return DFB_INIT;
-     }
+          /* Rendering on another device, scanout buffers are shared as dma-buf. */
+          if (*egl->shared->render_name && !egl->dumb && !egl->headless) {
+               egl->render_fd = open( egl->shared->render_name, O_RDWR );
+               if (egl->render_fd < 0) {
+                    D_PERROR( "EGL/System: Failed to open '%s'!\n", egl->shared->render_name );
+                    return DFB_INIT;
+               }
 
-     egl->size.w = egl->connector->modes[0].hdisplay;
-     egl->size.h = egl->connector->modes[0].vdisplay;
+               egl->render_gbm = gbm_create_device( egl->render_fd );
+               if (!egl->render_gbm) {
+                    D_ERROR( "EGL/System: gbm_create_device() failed!\n" );
+                    return DFB_INIT;
+               }
 
-     D_INFO( "EGL/System: Found display configuration\n" );
+               D_INFO( "EGL/System: Rendering on %s, scanning out on %s\n", egl->shared->render_name, device_name );
+          }
 
-     /* Create EGL window surface. */
-     egl->gbm_surface = gbm_surface_create( egl->gbm, egl->size.w, egl->size.h, GBM_FORMAT_XRGB8888, GBM_BO_USE_SCANOUT );
-     if (!egl->gbm_surface) {
-          D_ERROR( "EGL/System: gbm_surface_create() failed!\n" );
-          return DFB_INIT;
+          if (!egl->dumb)
+               egl->eglDisplay = eglGetDisplay( egl->render_gbm ?: egl->gbm );
      }
 
-     egl->eglSurface = eglCreateWindowSurface( egl->eglDisplay, config, egl->gbm_surface, NULL );
-     if (!egl->eglSurface) {
-          D_ERROR( "EGL/System: eglCreateWindowSurface() failed: 0x%x!\n", (unsigned int) eglGetError() );
-          return DFB_INIT;
-     }
+     if (egl->dumb) {
+          /* Software rendering into dumb buffers, EGL is not used. */
+          ret = kms_init( egl );
+          if (ret)
+               return ret;
 
-     /* Create EGL context and attach it to the EGL window surface. */
-     egl->eglContext = eglCreateContext( egl->eglDisplay, config, EGL_NO_CONTEXT, context_attr );
-     if (!egl->eglContext) {
-          D_ERROR( "EGL/System: eglCreateContext() failed: 0x%x!\n", (unsigned int) eglGetError() );
-          return DFB_INIT;
-     }
+          D_INFO( "EGL/System: Using dumb buffers\n" );
 
-     if (!eglMakeCurrent( egl->eglDisplay, egl->eglSurface, egl->eglSurface, egl->eglContext )) {
-          D_ERROR( "EGL/System: eglMakeCurrent() failed: 0x%x!\n", (unsigned int) eglGetError() );
-          return DFB_INIT;
+          /* No GL context for a graphics driver, rendering is done by the software rasterizer. */
+          dfb_config->software_only = true;
+     }
+     else {
+          ret = gl_init( egl, format_index );
+          if (ret)
+               return ret;
      }
 
      screen = dfb_screens_register( egl, &eglScreenFuncs );
 
      dfb_layers_register( screen, egl, &eglPrimaryLayerFuncs );
 
+     /* Hardware cursor. */
+     if (!egl->headless && !egl->dumb && !direct_config_has_name( "eglgbm-no-cursor" )) {
+          uint64_t cursor_width, cursor_height;
+
+          if (drmGetCap( egl->fd, DRM_CAP_CURSOR_WIDTH, &cursor_width ))
+               cursor_width = 64;
+
+          if (drmGetCap( egl->fd, DRM_CAP_CURSOR_HEIGHT, &cursor_height ))
+               cursor_height = 64;
+
+          egl->cursor_size.w = cursor_width;
+          egl->cursor_size.h = cursor_height;
+
+          egl->cursor_bo = gbm_bo_create( egl->gbm, cursor_width, cursor_height, GBM_FORMAT_ARGB8888,
+                                          GBM_BO_USE_CURSOR | GBM_BO_USE_WRITE );
+          if (egl->cursor_bo)
+               dfb_layers_register( screen, egl, &eglCursorLayerFuncs );
+          else
+               D_INFO( "EGL/System: No hardware cursor\n" );
+     }
+
      return DFB_OK;
 }
 
 static DFBResult
 local_deinit( EGLData *egl )
 {
+     if (egl->idle_thread)
+          egl_idle_stop( egl );
+
+     if (egl->main_thread.egl) {
+          direct_tls_unregister( &egl->thread_key );
+
+          direct_mutex_deinit( &egl->threads_lock );
+     }
+
      if (egl->eglContext) {
           eglMakeCurrent( egl->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
           eglDestroyContext( egl->eglDisplay, egl->eglContext );
      }
 
+     egl_destroy_retired( egl );
+
      if (egl->eglSurface)
           eglDestroySurface( egl->eglDisplay, egl->eglSurface );
 
      if (egl->gbm_surface)
           gbm_surface_destroy( egl->gbm_surface );
 
+     if (egl->out_fence != -1)
+          close( egl->out_fence );
+
+     if (egl->lease)
+          egl_lease_deinit( egl );
+
+     if (egl->writeback)
+          egl_writeback_deinit( egl );
+
+     if (egl->export)
+          egl_export_deinit( egl );
+
+     if (egl->sink)
+          egl_sink_close( egl->sink );
+
+     if (egl->readback)
+          D_FREE( egl->readback );
+
+     if (egl->cursor_bo) {
+          if (egl->cursor_visible)
+               drmModeSetCursor( egl->fd, egl->crtc->crtc_id, 0, 0, 0 );
+
+          gbm_bo_destroy( egl->cursor_bo );
+     }
+
+     /* The console or the next DRM client does not expect a color adjustment or a rotation. */
+     if (egl->atomic && (egl->gamma_blob || egl->ctm_blob || egl->plane_rotation)) {
+          drmModeAtomicReq *req = drmModeAtomicAlloc();
+
+          if (egl->gamma_blob || egl->ctm_blob) {
+               egl_kms_add_property( req, &egl->kms_crtc, "GAMMA_LUT", 0 );
+               egl_kms_add_property( req, &egl->kms_crtc, "CTM",       0 );
+          }
+
+          /* The rotated buffer does not fit the plane unrotated, the plane is off until the CRTC is restored. */
+          if (egl->plane_rotation) {
+               egl_kms_add_property( req, &egl->kms_plane, "FB_ID",    0 );
+               egl_kms_add_property( req, &egl->kms_plane, "CRTC_ID",  0 );
+               egl_kms_add_property( req, &egl->kms_plane, "rotation", DRM_MODE_ROTATE_0 );
+          }
+
+          if (drmModeAtomicCommit( egl->fd, req, DRM_MODE_ATOMIC_ALLOW_MODESET, NULL ))
+               D_PERROR( "EGL/System: Could not reset the color adjustment and the rotation!\n" );
+
+          drmModeAtomicFree( req );
+     }
+
      if (egl->crtc) {
           drmModeSetCrtc( egl->fd, egl->crtc->crtc_id, egl->crtc->buffer_id, egl->crtc->x, egl->crtc->y,
                           &egl->connector->connector_id, 1, &egl->crtc->mode );
           drmModeFreeCrtc( egl->crtc );
      }
 
+     if (egl->mode_blob)
+          drmModeDestroyPropertyBlob( egl->fd, egl->mode_blob );
+
+     if (egl->idle_blob)
+          drmModeDestroyPropertyBlob( egl->fd, egl->idle_blob );
+
+     if (egl->gamma_blob)
+          drmModeDestroyPropertyBlob( egl->fd, egl->gamma_blob );
+
+     if (egl->ctm_blob)
+          drmModeDestroyPropertyBlob( egl->fd, egl->ctm_blob );
+
+     egl_kms_object_deinit( &egl->kms_plane );
+     egl_kms_object_deinit( &egl->kms_crtc );
+     egl_kms_object_deinit( &egl->kms_connector );
+
+     if (egl->modifiers)
+          D_FREE( egl->modifiers );
+
      if (egl->encoder)
           drmModeFreeEncoder( egl->encoder );
 
@@ -247,6 +1267,12 @@ local_deinit( EGLData *egl )
      if (egl->eglDisplay)
           eglTerminate( egl->eglDisplay );
 
+     if (egl->render_gbm)
+          gbm_device_destroy( egl->render_gbm );
+
+     if (egl->render_fd != -1)
+          close( egl->render_fd );
+
      if (egl->gbm)
           gbm_device_destroy( egl->gbm );
 
@@ -258,6 +1284,296 @@ local_deinit( EGLData *egl )
 
 /**********************************************************************************************************************/
 
+static DFBResult
+scanout_format_init( EGLData  *egl,
+                     uint32_t  format )
+{
+     int index = find_format_index( format );
+
+     D_INFO( "EGL/System: Switching to %s scanout format\n", format_table[index].name );
+
+     /* The modifiers and the EGL config depend on the format. */
+     egl->format        = format;
+     egl->modifiers     = NULL;
+     egl->num_modifiers = 0;
+
+     if (egl->atomic && !direct_config_has_name( "eglgbm-linear" ))
+          get_plane_modifiers( egl );
+
+     if (egl->render_gbm)
+          prime_probe( egl );
+
+     return choose_config( egl, index );
+}
+
+uint32_t
+egl_scanout_format( EGLData               *egl,
+                    DFBSurfacePixelFormat  format )
+{
+     switch (format) {
+          case DSPF_RGB16:
+               return GBM_FORMAT_RGB565;
+
+          case DSPF_ARGB:
+          case DSPF_RGB32:
+               /* The alpha channel is ignored by the primary plane, a 32 bit format from eglgbm-format is kept. */
+               return egl->format == GBM_FORMAT_RGB565 ? GBM_FORMAT_XRGB8888 : egl->format;
+
+          default:
+               return 0;
+     }
+}
+
+DFBResult
+egl_resize_scanout( EGLData  *egl,
+                    int       width,
+                    int       height,
+                    uint32_t  format )
+{
+     DFBResult           ret           = DFB_OK;
+     struct gbm_surface *gbm_surface   = egl->gbm_surface;
+     EGLSurface          eglSurface    = egl->eglSurface;
+     DFBDimension        scanout       = egl->scanout;
+     EGLConfig           config        = egl->eglConfig;
+     uint32_t            old_format    = egl->format;
+     uint64_t           *modifiers     = egl->modifiers;
+     int                 num_modifiers = egl->num_modifiers;
+
+     /* Dumb buffers are allocated at the layer size and format, headless frames are read back. */
+     if (egl->dumb || egl->headless)
+          return DFB_OK;
+
+     /* The main context is only current on the presenting thread, which resizes before its next frame. */
+     if (egl_thread_data( egl ) != &egl->main_thread) {
+          D_DEBUG_AT( EGL_System, "%s( %dx%d ) -> deferred\n", __FUNCTION__, width, height );
+
+          egl->resize.w      = width;
+          egl->resize.h      = height;
+          egl->resize_format = format;
+
+          __atomic_store_n( &egl->resize_pending, true, __ATOMIC_RELEASE );
+
+          return DFB_OK;
+     }
+
+     __atomic_store_n( &egl->resize_pending, false, __ATOMIC_RELAXED );
+
+     if (egl->scanout.w == width && egl->scanout.h == height && egl->format == format)
+          return DFB_OK;
+
+     D_DEBUG_AT( EGL_System, "%s( %dx%d )\n", __FUNCTION__, width, height );
+
+     /* The buffer of a pending commit goes back to its surface. */
+     egl_idle_lock( egl );
+
+     egl_wait_out_fence( egl );
+
+     egl_idle_unlock( egl );
+
+     /* The previous scanout surface is kept until the new one is current. */
+     egl->gbm_surface = NULL;
+     egl->eglSurface  = EGL_NO_SURFACE;
+
+     if (format != egl->format)
+          ret = scanout_format_init( egl, format );
+
+     if (ret == DFB_OK)
+          ret = create_scanout( egl, width, height );
+
+     if (ret == DFB_OK &&
+         !eglMakeCurrent( egl->eglDisplay, egl->eglSurface, egl->eglSurface, egl->eglContext )) {
+          D_ERROR( "EGL/System: eglMakeCurrent() failed: 0x%x!\n", (unsigned int) eglGetError() );
+          ret = DFB_FAILURE;
+     }
+
+     if (ret) {
+          if (egl->eglSurface)
+               eglDestroySurface( egl->eglDisplay, egl->eglSurface );
+
+          if (egl->gbm_surface)
+               gbm_surface_destroy( egl->gbm_surface );
+
+          if (egl->modifiers != modifiers && egl->modifiers)
+               D_FREE( egl->modifiers );
+
+          egl->gbm_surface   = gbm_surface;
+          egl->eglSurface    = eglSurface;
+          egl->scanout       = scanout;
+          egl->eglConfig     = config;
+          egl->format        = old_format;
+          egl->modifiers     = modifiers;
+          egl->num_modifiers = num_modifiers;
+
+          eglMakeCurrent( egl->eglDisplay, egl->eglSurface, egl->eglSurface, egl->eglContext );
+
+          return ret;
+     }
+
+     if (egl->modifiers != modifiers && modifiers)
+          D_FREE( modifiers );
+
+     /*
+      * Removing the framebuffer on screen would turn the plane off, so the previous scanout surface is retired until
+      * the first commit of the new one has completed. The next commit sets the mode again.
+      */
+     egl_idle_lock( egl );
+
+     if (egl->retired_surface) {
+          /* The previous surface never got on screen, the retired one still is. */
+          eglDestroySurface( egl->eglDisplay, eglSurface );
+          gbm_surface_destroy( gbm_surface );
+     }
+     else {
+          egl->retired_surface    = gbm_surface;
+          egl->retired_eglSurface = eglSurface;
+          egl->retired_bo         = egl->front_bo;
+     }
+
+     egl->front_bo = NULL;
+     egl->modeset  = true;
+
+     egl_idle_unlock( egl );
+
+     egl_export_reset( egl );
+
+     return DFB_OK;
+}
+
+void
+egl_destroy_retired( EGLData *egl )
+{
+     if (!egl->retired_surface)
+          return;
+
+     D_DEBUG_AT( EGL_System, "%s()\n", __FUNCTION__ );
+
+     if (egl->retired_bo)
+          gbm_surface_release_buffer( egl->retired_surface, egl->retired_bo );
+
+     eglDestroySurface( egl->eglDisplay, egl->retired_eglSurface );
+     gbm_surface_destroy( egl->retired_surface );
+
+     egl->retired_surface    = NULL;
+     egl->retired_eglSurface = EGL_NO_SURFACE;
+     egl->retired_bo         = NULL;
+}
+
+void
+egl_resize_pending( EGLData *egl )
+{
+     if (!__atomic_load_n( &egl->resize_pending, __ATOMIC_ACQUIRE ))
+          return;
+
+     egl_resize_scanout( egl, egl->resize.w, egl->resize.h, egl->resize_format );
+}
+
+EGLThreadData *
+egl_thread_data( EGLData *egl )
+{
+     EGLThreadData *thread;
+
+     thread = direct_tls_get( &egl->thread_key );
+     if (thread)
+          return thread;
+
+     if (!egl->surfaceless) {
+          D_ONCE( "EGL_KHR_surfaceless_context not supported, no context for other threads" );
+          return &egl->main_thread;
+     }
+
+     thread = D_CALLOC( 1, sizeof(EGLThreadData) );
+     if (!thread) {
+          D_OOM();
+          return &egl->main_thread;
+     }
+
+     thread->egl = egl;
+
+     thread->context = eglCreateContext( egl->eglDisplay, egl->no_config ? EGL_NO_CONFIG_KHR : egl->eglConfig,
+                                         egl->eglContext, egl->context_attr );
+     if (!thread->context) {
+          D_ERROR( "EGL/System: eglCreateContext() failed: 0x%x!\n", (unsigned int) eglGetError() );
+          D_FREE( thread );
+          return &egl->main_thread;
+     }
+
+     if (!eglMakeCurrent( egl->eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, thread->context )) {
+          D_ERROR( "EGL/System: eglMakeCurrent() failed: 0x%x!\n", (unsigned int) eglGetError() );
+          eglDestroyContext( egl->eglDisplay, thread->context );
+          D_FREE( thread );
+          return &egl->main_thread;
+     }
+
+     direct_tls_set( &egl->thread_key, thread );
+
+     direct_mutex_lock( &egl->threads_lock );
+     direct_list_append( &egl->threads, &thread->link );
+     direct_mutex_unlock( &egl->threads_lock );
+
+     /* Fences are flushed when inserted from now on. */
+     __atomic_add_fetch( &egl->contexts, 1, __ATOMIC_RELEASE );
+
+     D_DEBUG_AT( EGL_System, "  -> created context %p for thread '%s'\n", thread->context, direct_thread_self_name() );
+
+     return thread;
+}
+
+uint32_t
+egl_kms_property_id( const EGLKMSObject *object,
+                     const char         *name )
+{
+     int i;
+
+     if (!object->props)
+          return 0;
+
+     for (i = 0; i < object->props->count_props; i++) {
+          if (object->props_info[i] && !strcmp( object->props_info[i]->name, name ))
+               return object->props_info[i]->prop_id;
+     }
+
+     return 0;
+}
+
+bool
+egl_kms_get_property( const EGLKMSObject *object,
+                      const char         *name,
+                      uint64_t           *ret_value )
+{
+     uint32_t prop_id = egl_kms_property_id( object, name );
+     int      i;
+
+     if (!prop_id)
+          return false;
+
+     for (i = 0; i < object->props->count_props; i++) {
+          if (object->props->props[i] == prop_id) {
+               *ret_value = object->props->prop_values[i];
+               return true;
+          }
+     }
+
+     return false;
+}
+
+bool
+egl_kms_add_property( drmModeAtomicReq   *req,
+                      const EGLKMSObject *object,
+                      const char         *name,
+                      uint64_t            value )
+{
+     uint32_t prop_id = egl_kms_property_id( object, name );
+
+     if (!prop_id) {
+          D_DEBUG_AT( EGL_System, "  -> no '%s' property on object %u\n", name, object->id );
+          return false;
+     }
+
+     return drmModeAtomicAddProperty( req, object->id, prop_id, value ) >= 0;
+}
+
+/**********************************************************************************************************************/
+
 static void
 system_get_info( CoreSystemInfo *info )
 {
@@ -308,11 +1624,21 @@ system_initialize( CoreDFB  *core,
           direct_snputs( shared->device_name, getenv( "DRICARD" ), 255 );
           D_INFO( "EGL/System: Using device %s as set in DRICARD environment variable\n", shared->device_name );
      }
+     else if (direct_config_has_name( "eglgbm-headless" )) {
+          find_render_node( shared );
+          if (*shared->device_name)
+               D_INFO( "EGL/System: Using render node %s\n", shared->device_name );
+          else
+               D_INFO( "EGL/System: Using surfaceless platform\n" );
+     }
      else {
           snprintf( shared->device_name, 255, "/dev/dri/card0" );
           D_INFO( "EGL/System: Using device %s (default)\n", shared->device_name );
      }
 
+     if ((value = direct_config_get_value( "eglgbm-render" )))
+          direct_snputs( shared->render_name, value, 255 );
+
      ret = local_init( shared->device_name, egl );
      if (ret)
           goto error;
@@ -323,7 +1649,8 @@ system_initialize( CoreDFB  *core,
 
      *ret_data = egl;
 
-     ret = dfb_surface_pool_initialize( core, &eglSurfacePoolFuncs, &shared->pool );
+     ret = dfb_surface_pool_initialize( core, egl->dumb ? &eglDumbSurfacePoolFuncs : &eglSurfacePoolFuncs,
+                                        &shared->pool );
      if (ret)
           goto error;
 
@@ -373,7 +1700,7 @@ system_join( CoreDFB  *core,
 
      *ret_data = egl;
 
-     ret = dfb_surface_pool_join( core, shared->pool, &eglSurfacePoolFuncs );
+     ret = dfb_surface_pool_join( core, shared->pool, egl->dumb ? &eglDumbSurfacePoolFuncs : &eglSurfacePoolFuncs );
      if (ret)
           goto error;
 
@@ -436,13 +1763,44 @@ system_leave( bool emergency )
 static DFBResult
 system_suspend()
 {
+     EGLData *egl = dfb_system_data();
+
+     D_DEBUG_AT( EGL_System, "%s()\n", __FUNCTION__ );
+
+     if (egl->headless || !dfb_core_is_master( egl->core ))
+          return DFB_OK;
+
+     /* The GBM device, the contexts and the textures stay, only presenting stops. */
+     egl_idle_lock( egl );
+
+     egl->suspended = true;
+
+     egl_idle_unlock( egl );
+
+     if (drmDropMaster( egl->fd ))
+          D_PERROR( "EGL/System: Could not drop DRM master!\n" );
+
      return DFB_OK;
 }
 
 static DFBResult
 system_resume()
 {
-     return DFB_OK;
+     EGLData *egl = dfb_system_data();
+
+     D_DEBUG_AT( EGL_System, "%s()\n", __FUNCTION__ );
+
+     if (!egl->suspended)
+          return DFB_OK;
+
+     if (drmSetMaster( egl->fd )) {
+          D_PERROR( "EGL/System: Could not acquire DRM master!\n" );
+          return DFB_ACCESSDENIED;
+     }
+
+     egl->suspended = false;
+
+     return egl_restore_display( egl );
 }
 
 static VideoMode *
@@ -460,6 +1818,11 @@ system_get_current_mode()
 static DFBResult
 system_thread_init()
 {
+     EGLData *egl = dfb_system_data();
+
+     if (egl && !egl->dumb)
+          egl_thread_data( egl );
+
      return DFB_OK;
 }
 
@@ -512,7 +1875,9 @@ system_video_memory_virtual( unsigned int offset )
 static unsigned int
 system_videoram_length()
 {
-     return 0;
+     EGLData *egl = dfb_system_data();
+
+     return egl->videoram;
 }
 
 static void
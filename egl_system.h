@@ -20,20 +20,119 @@
 #define __EGL_SYSTEM_H__
 
 #include <core/coretypes.h>
+#include <direct/thread.h>
 #include <fusion/types.h>
+#include <drm_fourcc.h>
 #include <gbm.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES2/gl2.h>
 
 /**********************************************************************************************************************/
 
+typedef struct {
+     uint32_t                  id;
+     uint32_t                  type;             /* DRM_MODE_OBJECT_xxx */
+
+     drmModeObjectProperties  *props;
+     drmModePropertyRes      **props_info;
+} EGLKMSObject;
+
+typedef struct _EGLData EGLData;
+
+typedef struct _EGLSink EGLSink;
+
+/*
+ * Layout of the shared memory frame sink: the header is followed by 'slots' frames of 'pitch' * 'height' bytes.
+ * The frame 'sequence' - 1 is complete in slot ('sequence' - 1) % 'slots', 'sequence' is updated after the frame.
+ */
+typedef struct {
+     uint32_t                  magic;            /* EGL_SINK_MAGIC */
+     uint32_t                  format;           /* DRM fourcc of 32 bit pixels */
+     uint32_t                  width;
+     uint32_t                  height;
+     uint32_t                  pitch;
+     uint32_t                  slots;
+     uint64_t                  sequence;         /* number of frames written */
+} EGLSinkHeader;
+
+#define EGL_SINK_MAGIC 0x4b4e4953 /* 'SINK' */
+
+typedef struct _EGLExport EGLExport;
+
+typedef struct _EGLWriteback EGLWriteback;
+
+typedef struct _EGLDeletion EGLDeletion;
+
+typedef struct _EGLLease EGLLease;
+
+/*
+ * Message sent to the lessee with the lease fd as SCM_RIGHTS. With 'shared' set, the connector and the CRTC are still
+ * used for the display and only the plane may be updated. The lease is revoked when the lessee disconnects.
+ */
+typedef struct {
+     uint32_t                  magic;            /* EGL_LEASE_MAGIC */
+     uint32_t                  lessee_id;
+     uint32_t                  connector_id;
+     uint32_t                  crtc_id;
+     uint32_t                  plane_id;         /* overlay plane of a shared CRTC, primary plane otherwise */
+     uint32_t                  shared;
+} EGLLeaseInfo;
+
+#define EGL_LEASE_MAGIC 0x5341454c /* 'LEAS' */
+
+/*
+ * Message sent to the frame consumer for each exported frame, with the dma-buf fds of the planes and, if 'fence' is
+ * set, a sync file fd as SCM_RIGHTS. The buffer stays valid until the consumer sends back an EGLExportRelease.
+ */
+typedef struct {
+     uint32_t                  magic;            /* EGL_EXPORT_MAGIC */
+     uint32_t                  sequence;
+     uint32_t                  width;
+     uint32_t                  height;
+     uint32_t                  format;           /* DRM fourcc */
+     uint32_t                  planes;
+     uint64_t                  modifier;
+     uint32_t                  offsets[4];
+     uint32_t                  strides[4];
+     uint32_t                  fence;            /* sync file fd follows the plane fds */
+     DFBRegion                 damage;           /* region updated since the previous exported frame */
+} EGLExportFrame;
+
+typedef struct {
+     uint32_t                  magic;            /* EGL_EXPORT_MAGIC */
+     uint32_t                  sequence;         /* frame no longer used by the consumer */
+} EGLExportRelease;
+
+#define EGL_EXPORT_MAGIC 0x54525058 /* 'XPRT' */
+
+typedef struct {
+     DirectLink                link;             /* in the list of thread contexts */
+
+     EGLData                  *egl;
+
+     EGLContext                context;          /* context shared with the main one */
+
+     GLuint                    bound_fbo;        /* shadow of GL_FRAMEBUFFER_BINDING */
+     GLuint                    bound_tex;        /* shadow of GL_TEXTURE_BINDING_2D, unknown after a read lock */
+     int                       tex_generation;   /* texture deletions when bound_tex was set */
+
+     GLuint                    fbo;              /* framebuffer for allocations of other contexts */
+     EGLDeletion              *deletions;        /* framebuffer objects of this context released elsewhere */
+
+     bool                      flush_pending;    /* fences inserted since the last flush */
+     int                       flush_seen;       /* flush requests already served */
+} EGLThreadData;
+
 typedef struct {
      FusionSHMPoolShared *shmpool;
 
      CoreSurfacePool     *pool;
 
      char                 device_name[256]; /* device name, e.g. /dev/dri/card0 */
+     char                 render_name[256]; /* separate render device, e.g. /dev/dri/renderD129 */
 
      DFBDimension         mode;             /* current video mode */
 
@@ -49,25 +148,255 @@ typedef struct {
      } device;
 } EGLDataShared;
 
-typedef struct {
-     EGLDataShared      *shared;
+struct _EGLData {
+     EGLDataShared                    *shared;
+
+     CoreDFB                          *core;
+
+     int                               fd;
+     struct gbm_device                *gbm;
+     int                               render_fd;            /* separate render device or -1 */
+     struct gbm_device                *render_gbm;           /* device of the EGL display and the scanout buffers */
+     EGLDisplay                        eglDisplay;
+
+     drmModeRes                       *resources;
+     drmModeConnector                 *connector;
+     char                              connector_name[32];
+     drmModeEncoder                   *encoder;
+     drmModeCrtc                      *crtc;
+     DFBDimension                      size;
+     drmModeModeInfo                   mode_info;
+
+     bool                              atomic;               /* atomic mode setting */
+     int                               crtc_index;
+     EGLKMSObject                      kms_connector;
+     EGLKMSObject                      kms_crtc;
+     EGLKMSObject                      kms_plane;            /* primary plane */
+     uint32_t                          mode_blob;
+     bool                              modeset;              /* next commit needs a full mode set */
+
+     bool                              explicit_sync;        /* native fence passed as IN_FENCE_FD */
+     int                               out_fence;            /* OUT_FENCE_PTR of the last commit */
+     struct gbm_bo                    *front_bo;             /* buffer of the last commit */
+     struct gbm_bo                    *prev_bo;              /* buffer released when the last commit completes */
+     uint32_t                          front_fb;             /* framebuffer on screen */
+     struct gbm_surface               *retired_surface;      /* previous scanout surface until the new one is shown */
+     EGLSurface                        retired_eglSurface;
+     struct gbm_bo                    *retired_bo;           /* buffer of the previous surface on screen */
+     bool                              suspended;            /* DRM master dropped, nothing is presented */
+
+     uint32_t                          format;               /* scanout fourcc */
+     uint64_t                         *modifiers;            /* scanout modifiers supported by the plane */
+     int                               num_modifiers;
+
+     uint32_t                          gamma_blob;           /* GAMMA_LUT of the color adjustment */
+     uint32_t                          ctm_blob;             /* CTM of the color adjustment */
+     bool                              color_pending;        /* color adjustment not yet committed */
+
+     DFBDimension                      cursor_size;          /* size of the hardware cursor */
+     struct gbm_bo                    *cursor_bo;
+     bool                              cursor_visible;
+     DFBPoint                          cursor_position;      /* cursor position in display coordinates */
+
+     struct gbm_surface               *gbm_surface;
+     DFBDimension                      scanout;              /* size of the scanout surface */
+     DFBDimension                      resize;               /* scanout size requested by another thread */
+     uint32_t                          resize_format;        /* scanout fourcc requested by another thread */
+     bool                              resize_pending;
+
+     uint64_t                          rotations;            /* rotations supported by the primary plane */
+     uint64_t                          plane_rotation;       /* rotation done by the primary plane */
+     bool                              plane_scaling;        /* scanout surface follows the layer size */
+
+     bool                              idle_skip;            /* skip presents without changes */
+     bool                              dirty;                /* primary layer written since the last present */
+     long long                         last_change;          /* time of the last present with changes */
+     long long                         idle_time;            /* time without changes before the idle mode */
+     drmModeModeInfo                   idle_mode;            /* lowest refresh rate at the display resolution */
+     uint32_t                          idle_blob;
+     bool                              idle;                 /* display running at the idle mode */
+     DirectThread                     *idle_thread;          /* switches to the idle mode without presents */
+     DirectMutex                       idle_lock;            /* serializes the switch with presents */
+     DirectWaitQueue                   idle_cond;
+     bool                              idle_stop;
+
+     EGLExport                        *export;               /* consumer of the scanout buffers */
+     EGLWriteback                     *writeback;            /* capture of the composed CRTC output */
+     EGLLease                         *lease;                /* plane or connector leased to another process */
+
+     bool                              headless;             /* offscreen rendering without KMS */
+     bool                              dumb;                 /* software rendering into dumb buffers */
+     uint32_t                          dumb_fb;              /* dumb buffer on screen */
+     EGLSink                          *sink;                 /* destination of headless frames */
+     u8                               *readback;             /* pixels of the last headless frame */
+     size_t                            readback_size;
+
+     unsigned long                     videoram;             /* texture memory budget (bytes), 0 for no limit */
+     EGLDeletion                      *deletions;            /* GL objects deleted after the next present */
+     int                               tex_generation;       /* incremented after texture names are deleted */
+     int                               contexts;             /* contexts of threads other than the main one */
+     int                               flush_requests;       /* flushes requested by waiters in other contexts */
+
+     EGLConfig                         eglConfig;
+     bool                              no_config;            /* EGL_KHR_no_config_context, for format changes */
+     EGLSurface                        eglSurface;
+     EGLContext                        eglContext;
+     EGLint                            context_attr[5];
+     EGLint                            context_priority;     /* EGL_IMG_context_priority level requested */
+
+     bool                              surfaceless;          /* EGL_KHR_surfaceless_context */
+     DirectTLS                         thread_key;           /* per-thread EGLThreadData */
+     EGLThreadData                     main_thread;          /* thread data of the main context */
+     DirectMutex                       threads_lock;
+     DirectLink                       *threads;              /* thread data of the other contexts */
+
+     /* EGL_KHR_fence_sync / EGL_KHR_wait_sync */
+     PFNEGLCREATESYNCKHRPROC           eglCreateSyncKHR;
+     PFNEGLDESTROYSYNCKHRPROC          eglDestroySyncKHR;
+     PFNEGLCLIENTWAITSYNCKHRPROC       eglClientWaitSyncKHR;
+     PFNEGLGETSYNCATTRIBKHRPROC        eglGetSyncAttribKHR;
+     PFNEGLWAITSYNCKHRPROC             eglWaitSyncKHR;
+
+     /* EGL_ANDROID_native_fence_sync */
+     PFNEGLDUPNATIVEFENCEFDANDROIDPROC eglDupNativeFenceFDANDROID;
+};
+
+/**********************************************************************************************************************/
+
+EGLThreadData *egl_thread_data( EGLData *egl );
+
+DFBResult egl_resize_scanout( EGLData  *egl,
+                              int       width,
+                              int       height,
+                              uint32_t  format );
+
+uint32_t  egl_scanout_format( EGLData               *egl,
+                              DFBSurfacePixelFormat  format );
+
+void      egl_resize_pending( EGLData *egl );
+
+void      egl_destroy_retired( EGLData *egl );
+
+void      egl_delete_deferred( EGLData *egl );
+
+void      egl_delete_owned   ( EGLThreadData *thread );
+
+void      egl_flush_requested( EGLData       *egl,
+                               EGLThreadData *thread );
+
+DFBResult egl_restore_display( EGLData *egl );
+
+void      egl_wait_out_fence ( EGLData *egl );
+
+void      egl_idle_start     ( EGLData *egl );
+
+void      egl_idle_stop      ( EGLData *egl );
+
+void      egl_idle_lock      ( EGLData *egl );
+
+void      egl_idle_unlock    ( EGLData *egl );
+
+uint32_t  egl_bo_get_fb( EGLData       *egl,
+                         struct gbm_bo *bo );
+
+bool      egl_test_scaling( EGLData *egl,
+                            int      width,
+                            int      height );
+
+uint32_t  egl_kms_find_plane    ( EGLData                *egl,
+                                 int                     crtc_index,
+                                 uint64_t                plane_type );
+
+void      egl_kms_connector_name( const drmModeConnector *connector,
+                                 char                   *buf,
+                                 size_t                  size );
+
+DFBResult egl_kms_object_init  ( int                 fd,
+                                 EGLKMSObject       *object,
+                                 uint32_t            id,
+                                 uint32_t            type );
+
+void      egl_kms_object_deinit( EGLKMSObject       *object );
+
+uint32_t egl_kms_property_id ( const EGLKMSObject *object,
+                               const char         *name );
+
+bool     egl_kms_get_property( const EGLKMSObject *object,
+                               const char         *name,
+                               uint64_t           *ret_value );
+
+bool     egl_kms_add_property( drmModeAtomicReq   *req,
+                               const EGLKMSObject *object,
+                               const char         *name,
+                               uint64_t            value );
+
+DFBResult egl_export_init   ( EGLData         *egl,
+                              const char      *path );
+
+void      egl_export_deinit ( EGLData         *egl );
+
+void      egl_export_frame  ( EGLData         *egl,
+                              struct gbm_bo   *bo,
+                              int              fence,
+                              const DFBRegion *damage );
+
+bool      egl_export_release( EGLData         *egl,
+                              struct gbm_bo   *bo );
+
+void      egl_export_reset  ( EGLData         *egl );
+
+DFBResult egl_writeback_init     ( EGLData          *egl,
+                                  const char       *spec,
+                                  int               interval );
+
+void      egl_writeback_deinit   ( EGLData          *egl );
+
+/* Captures the next commit, e.g. for a screenshot of a test harness. */
+void      egl_writeback_capture  ( EGLData          *egl );
+
+bool      egl_writeback_requested( EGLData          *egl );
+
+void      egl_writeback_add      ( EGLData          *egl,
+                                  drmModeAtomicReq *req,
+                                  uint32_t         *flags );
+
+void      egl_writeback_committed( EGLData          *egl,
+                                  bool              success );
+
+DFBResult egl_lease_init  ( EGLData    *egl,
+                            const char *path,
+                            const char *connector );
+
+void      egl_lease_deinit( EGLData    *egl );
+
+DFBResult egl_sink_open ( const char  *spec,
+                          EGLSink    **ret_sink );
 
-     CoreDFB            *core;
+DFBResult egl_sink_write( EGLSink     *sink,
+                          const void  *pixels,
+                          int          pitch,
+                          int          width,
+                          int          height,
+                          uint32_t     format );
 
-     int                 fd;
-     struct gbm_device  *gbm;
-     EGLDisplay          eglDisplay;
+void      egl_sink_close( EGLSink     *sink );
 
-     drmModeRes         *resources;
-     drmModeConnector   *connector;
-     drmModeEncoder     *encoder;
-     drmModeCrtc        *crtc;
-     DFBDimension        size;
+size_t    egl_etc2_size  ( int          width,
+                           int          height,
+                           bool         alpha );
 
-     struct gbm_surface *gbm_surface;
+void      egl_etc2_encode( const u8    *rgba,
+                           int          pitch,
+                           int          width,
+                           int          height,
+                           bool         alpha,
+                           u8          *blocks );
 
-     EGLSurface          eglSurface;
-     EGLContext          eglContext;
-} EGLData;
+void      egl_etc2_decode( const u8    *blocks,
+                           int          width,
+                           int          height,
+                           bool         alpha,
+                           u8          *rgba,
+                           int          pitch );
 
 #endif
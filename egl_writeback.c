@@ -0,0 +1,402 @@
+/*
+   This file is part of DirectFB.
+
+   This library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   This library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with this library; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "egl_system.h"
+
+D_DEBUG_DOMAIN( EGL_Writeback, "EGL/Writeback", "EGL Writeback" );
+
+/**********************************************************************************************************************/
+
+struct _EGLWriteback {
+     EGLKMSObject     connector;
+     bool             attached;      /* connector routed to the CRTC */
+
+     struct gbm_bo   *bo;            /* capture buffer */
+     uint32_t         fb_id;
+
+     int              fence;         /* WRITEBACK_OUT_FENCE_PTR of the current commit */
+     bool             requested;     /* capture the next commit */
+     bool             capturing;     /* capture attached to the current commit */
+     int              interval;      /* capture every n-th commit, 0 for requested captures only */
+     int              commits;
+
+     EGLSink         *sink;          /* destination of the captured frames */
+
+     DirectThread    *thread;        /* writes the captured frames to the sink */
+     DirectMutex      lock;
+     DirectWaitQueue  cond;
+     int              pending;       /* fence of the capture handed to the thread or -1 */
+     bool             busy;          /* capture buffer in use until the thread is done */
+     bool             stop;
+};
+
+/**********************************************************************************************************************/
+
+static uint32_t
+find_writeback_connector( EGLData *egl )
+{
+     drmModeRes       *resources;
+     drmModeConnector *connector;
+     drmModeEncoder   *encoder;
+     uint32_t          connector_id = 0;
+     int               i;
+
+     /* Writeback connectors are only listed once the client cap is set. */
+     resources = drmModeGetResources( egl->fd );
+     if (!resources)
+          return 0;
+
+     for (i = 0; i < resources->count_connectors && !connector_id; i++) {
+          connector = drmModeGetConnector( egl->fd, resources->connectors[i] );
+          if (!connector)
+               continue;
+
+          if (connector->connector_type == DRM_MODE_CONNECTOR_WRITEBACK && connector->count_encoders) {
+               encoder = drmModeGetEncoder( egl->fd, connector->encoders[0] );
+               if (encoder) {
+                    if (encoder->possible_crtcs & (1 << egl->crtc_index))
+                         connector_id = connector->connector_id;
+
+                    drmModeFreeEncoder( encoder );
+               }
+          }
+
+          drmModeFreeConnector( connector );
+     }
+
+     drmModeFreeResources( resources );
+
+     return connector_id;
+}
+
+static bool
+has_writeback_format( EGLData  *egl,
+                      uint32_t  format )
+{
+     drmModePropertyBlobRes *blob;
+     const uint32_t         *formats;
+     uint64_t                blob_id;
+     bool                    found = false;
+     int                     i;
+
+     if (!egl_kms_get_property( &egl->writeback->connector, "WRITEBACK_PIXEL_FORMATS", &blob_id ))
+          return false;
+
+     blob = drmModeGetPropertyBlob( egl->fd, blob_id );
+     if (!blob)
+          return false;
+
+     formats = blob->data;
+
+     for (i = 0; i < blob->length / sizeof(uint32_t); i++) {
+          if (formats[i] == format) {
+               found = true;
+               break;
+          }
+     }
+
+     drmModeFreePropertyBlob( blob );
+
+     return found;
+}
+
+static void
+egl_writeback_complete( EGLWriteback *writeback,
+                        int           fence )
+{
+     struct pollfd  pfd;
+     void          *map_data  = NULL;
+     void          *pixels;
+     uint32_t       stride;
+     uint32_t       width     = gbm_bo_get_width( writeback->bo );
+     uint32_t       height    = gbm_bo_get_height( writeback->bo );
+
+     pfd.fd     = fence;
+     pfd.events = POLLIN;
+
+     while (poll( &pfd, 1, -1 ) < 0 && (errno == EINTR || errno == EAGAIN));
+
+     close( fence );
+
+     pixels = gbm_bo_map( writeback->bo, 0, 0, width, height, GBM_BO_TRANSFER_READ, &stride, &map_data );
+     if (!pixels) {
+          D_ERROR( "EGL/Writeback: gbm_bo_map() failed!\n" );
+          return;
+     }
+
+     D_DEBUG_AT( EGL_Writeback, "  -> captured %ux%u\n", width, height );
+
+     egl_sink_write( writeback->sink, pixels, stride, width, height, gbm_bo_get_format( writeback->bo ) );
+
+     gbm_bo_unmap( writeback->bo, map_data );
+}
+
+static void *
+egl_writeback_loop( DirectThread *thread,
+                    void         *arg )
+{
+     EGLWriteback *writeback = arg;
+     int           fence;
+
+     D_DEBUG_AT( EGL_Writeback, "%s()\n", __FUNCTION__ );
+
+     direct_mutex_lock( &writeback->lock );
+
+     /* A pending capture is still written when stopping. */
+     while (writeback->pending != -1 || !writeback->stop) {
+          if (writeback->pending == -1) {
+               direct_waitqueue_wait( &writeback->cond, &writeback->lock );
+               continue;
+          }
+
+          fence = writeback->pending;
+
+          writeback->pending = -1;
+
+          direct_mutex_unlock( &writeback->lock );
+
+          egl_writeback_complete( writeback, fence );
+
+          direct_mutex_lock( &writeback->lock );
+
+          writeback->busy = false;
+     }
+
+     direct_mutex_unlock( &writeback->lock );
+
+     return NULL;
+}
+
+/**********************************************************************************************************************/
+
+DFBResult
+egl_writeback_init( EGLData    *egl,
+                    const char *spec,
+                    int         interval )
+{
+     DFBResult     ret;
+     EGLWriteback *writeback;
+     uint32_t      connector_id;
+     uint32_t      handles[4] = { 0 };
+     uint32_t      strides[4] = { 0 };
+     uint32_t      offsets[4] = { 0 };
+
+     D_DEBUG_AT( EGL_Writeback, "%s( '%s' )\n", __FUNCTION__, spec );
+
+     if (drmSetClientCap( egl->fd, DRM_CLIENT_CAP_WRITEBACK_CONNECTORS, 1 )) {
+          D_INFO( "EGL/Writeback: Writeback connectors not supported\n" );
+          return DFB_UNSUPPORTED;
+     }
+
+     connector_id = find_writeback_connector( egl );
+     if (!connector_id) {
+          D_INFO( "EGL/Writeback: No writeback connector for the CRTC\n" );
+          return DFB_UNSUPPORTED;
+     }
+
+     writeback = D_CALLOC( 1, sizeof(EGLWriteback) );
+     if (!writeback)
+          return D_OOM();
+
+     writeback->fence    = -1;
+     writeback->pending  = -1;
+     writeback->interval = MAX( interval, 0 );
+
+     direct_mutex_init( &writeback->lock );
+     direct_waitqueue_init( &writeback->cond );
+
+     egl->writeback = writeback;
+
+     ret = egl_kms_object_init( egl->fd, &writeback->connector, connector_id, DRM_MODE_OBJECT_CONNECTOR );
+     if (ret)
+          goto error;
+
+     if (!has_writeback_format( egl, DRM_FORMAT_XRGB8888 )) {
+          D_ERROR( "EGL/Writeback: XRGB8888 is not supported by the writeback connector!\n" );
+          ret = DFB_UNSUPPORTED;
+          goto error;
+     }
+
+     /* The display engine writes the composed CRTC output at the mode size, the CPU reads it linearly. */
+     writeback->bo = gbm_bo_create( egl->gbm, egl->mode_info.hdisplay, egl->mode_info.vdisplay, GBM_FORMAT_XRGB8888,
+                                    GBM_BO_USE_LINEAR );
+     if (!writeback->bo) {
+          D_ERROR( "EGL/Writeback: gbm_bo_create() failed!\n" );
+          ret = DFB_FAILURE;
+          goto error;
+     }
+
+     handles[0] = gbm_bo_get_handle( writeback->bo ).u32;
+     strides[0] = gbm_bo_get_stride( writeback->bo );
+
+     if (drmModeAddFB2( egl->fd, egl->mode_info.hdisplay, egl->mode_info.vdisplay, DRM_FORMAT_XRGB8888,
+                        handles, strides, offsets, &writeback->fb_id, 0 )) {
+          D_PERROR( "EGL/Writeback: drmModeAddFB2() failed!\n" );
+          ret = DFB_FAILURE;
+          goto error;
+     }
+
+     ret = egl_sink_open( spec, &writeback->sink );
+     if (ret)
+          goto error;
+
+     /* A slow sink reader delays the captures, not the presents. */
+     writeback->thread = direct_thread_create( DTT_DEFAULT, egl_writeback_loop, writeback, "EGL Writeback" );
+     if (!writeback->thread) {
+          ret = DFB_INIT;
+          goto error;
+     }
+
+     D_INFO( "EGL/Writeback: Capturing frames with connector %u\n", connector_id );
+
+     return DFB_OK;
+
+error:
+     egl_writeback_deinit( egl );
+
+     return ret;
+}
+
+void
+egl_writeback_deinit( EGLData *egl )
+{
+     EGLWriteback *writeback = egl->writeback;
+
+     D_DEBUG_AT( EGL_Writeback, "%s()\n", __FUNCTION__ );
+
+     if (writeback->thread) {
+          direct_mutex_lock( &writeback->lock );
+
+          writeback->stop = true;
+
+          direct_waitqueue_broadcast( &writeback->cond );
+
+          direct_mutex_unlock( &writeback->lock );
+
+          direct_thread_join( writeback->thread );
+          direct_thread_destroy( writeback->thread );
+     }
+
+     if (writeback->sink)
+          egl_sink_close( writeback->sink );
+
+     if (writeback->fb_id)
+          drmModeRmFB( egl->fd, writeback->fb_id );
+
+     if (writeback->bo)
+          gbm_bo_destroy( writeback->bo );
+
+     egl_kms_object_deinit( &writeback->connector );
+
+     direct_waitqueue_deinit( &writeback->cond );
+     direct_mutex_deinit( &writeback->lock );
+
+     D_FREE( writeback );
+
+     egl->writeback = NULL;
+}
+
+void
+egl_writeback_capture( EGLData *egl )
+{
+     if (egl->writeback)
+          __atomic_store_n( &egl->writeback->requested, true, __ATOMIC_RELEASE );
+}
+
+bool
+egl_writeback_requested( EGLData *egl )
+{
+     return __atomic_load_n( &egl->writeback->requested, __ATOMIC_ACQUIRE );
+}
+
+void
+egl_writeback_add( EGLData          *egl,
+                   drmModeAtomicReq *req,
+                   uint32_t         *flags )
+{
+     EGLWriteback *writeback = egl->writeback;
+     bool          busy;
+
+     direct_mutex_lock( &writeback->lock );
+
+     busy = writeback->busy;
+
+     direct_mutex_unlock( &writeback->lock );
+
+     /* While the previous capture is written to the sink, periodic captures are dropped and requests kept. */
+     if (busy)
+          return;
+
+     if (writeback->interval && ++writeback->commits >= writeback->interval) {
+          writeback->commits = 0;
+          egl_writeback_capture( egl );
+     }
+
+     /* A request arriving during the commit is for the next one. */
+     writeback->capturing = __atomic_exchange_n( &writeback->requested, false, __ATOMIC_ACQ_REL );
+     if (!writeback->capturing)
+          return;
+
+     if (!writeback->attached) {
+          egl_kms_add_property( req, &writeback->connector, "CRTC_ID", egl->crtc->crtc_id );
+
+          *flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
+     }
+
+     egl_kms_add_property( req, &writeback->connector, "WRITEBACK_FB_ID",         writeback->fb_id );
+     egl_kms_add_property( req, &writeback->connector, "WRITEBACK_OUT_FENCE_PTR", (uintptr_t) &writeback->fence );
+}
+
+void
+egl_writeback_committed( EGLData *egl,
+                         bool     success )
+{
+     EGLWriteback *writeback = egl->writeback;
+
+     if (!writeback->capturing)
+          return;
+
+     writeback->capturing = false;
+
+     if (success) {
+          if (writeback->fence != -1) {
+               writeback->attached = true;
+
+               direct_mutex_lock( &writeback->lock );
+
+               writeback->pending = writeback->fence;
+               writeback->busy    = true;
+
+               direct_waitqueue_signal( &writeback->cond );
+
+               direct_mutex_unlock( &writeback->lock );
+
+               writeback->fence = -1;
+          }
+     }
+     else {
+          writeback->fence = -1;
+
+          /* Captured with the next commit instead. */
+          egl_writeback_capture( egl );
+     }
+}